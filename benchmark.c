@@ -0,0 +1,649 @@
+/*****************************************************************************
+*    This file is part of project.
+*
+*    project is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    project is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with project.  If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/* Non-interactive benchmarks of the heap manager, with the C library's malloc as a
+   baseline. Each scenario runs once per allocator, in a child process of its own so that
+   the peak RSS of every run is its own, and prints a line of results : throughput,
+   latency percentiles, peak RSS and peak heap size.
+
+   usage : benchmark [-n ops per thread] [-t threads] [-s size] [-a heapmgr|libc|both]
+                     [scenario ...]
+
+   The scenarios are churn, powerlaw, realloc, prodcons, larson and xmalloc (all of
+   them by default). */
+
+#include "heapmngr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/* One op in LATENCY_SAMPLE is timed on its own, a power of two */
+#define LATENCY_SAMPLE  8
+
+/* The number of live regions each thread of churn, powerlaw and larson keeps */
+#define WINDOW          1024
+
+/* The number of buffers realloc grows, and the size at which they start over */
+#define REALLOC_BUFFERS 64
+#define REALLOC_LIMIT   (64 << 10)
+
+/* The capacity of the queue between a producer and a consumer, a power of two */
+#define QUEUE_SIZE      1024
+
+/* The number of regions xmalloc hands over at once */
+#define XMALLOC_BATCH   64
+
+/* The number of rounds of threads larson runs, each inheriting the regions of the last */
+#define LARSON_ROUNDS   10
+
+/* How often the heap size is sampled, in microseconds */
+#define MONITOR_PERIOD  2000
+
+#define MAX_THREADS     64
+
+/*--------------------------------------------------------------------*/
+
+/* An allocator under test */
+typedef struct Allocator {
+   const char *pcName;
+   void *(*pfMalloc)(size_t);
+   void (*pfFree)(void *);
+   void *(*pfRealloc)(void *, size_t);
+   size_t (*pfHeapBytes)(void);
+} Allocator;
+
+/* A queue between a producer and a consumer thread */
+typedef struct Queue {
+   void *apvSlots[QUEUE_SIZE];
+   unsigned int uiHead;
+   unsigned int uiTail;
+} Queue;
+
+/* A batch of regions xmalloc hands from an allocating thread to a freeing one */
+typedef struct Batch {
+   void *apvRegions[XMALLOC_BATCH];
+   struct Batch *psNext;
+} Batch;
+
+/* State shared by the threads of a run */
+typedef struct Shared {
+   Queue asQueues[MAX_THREADS / 2];
+   Batch *psBatches;
+   int iAllocatorsLeft;
+   pthread_mutex_t sLock;
+   void **appvLarson[MAX_THREADS];
+} Shared;
+
+/* A thread of a run */
+typedef struct Worker {
+   const Allocator *psAlloc;
+   Shared *psShared;
+   int iThread;
+   int iThreads;
+   long lOps;
+   size_t uiSize;
+   unsigned int uiSeed;
+   int iRound;
+
+   uint32_t *puiLatencies;
+   size_t uiLatencies;
+   size_t uiMaxLatencies;
+   /* Nanoseconds taken by the sampled ops */
+
+   long lDone;
+   /* The number of allocator calls made */
+} Worker;
+
+/* A scenario : the function each thread runs, and whether it needs pairs of threads */
+typedef struct Scenario {
+   const char *pcName;
+   void (*pfRun)(Worker *);
+   int iPaired;
+   const char *pcDescription;
+} Scenario;
+
+/*--------------------------------------------------------------------*/
+
+static size_t heapmgrBytes(void)
+
+/* Return the bytes the heap manager holds : heaps, slabs and mappings. */
+
+{
+   struct HeapMgrStats sStats;
+
+   my_heap_stats(&sStats);
+   return sStats.uiHeapBytes + sStats.uiSlabBytes + sStats.uiMappedBytes;
+}
+
+/*--------------------------------------------------------------------*/
+
+static size_t libcBytes(void)
+
+/* Return the bytes the C library's malloc holds : its arenas and mappings. */
+
+{
+   struct mallinfo2 sInfo = mallinfo2();
+
+   return sInfo.arena + sInfo.hblkhd;
+}
+
+static const Allocator asAllocators[] = {
+   {"heapmgr", my_malloc, my_free, my_realloc, heapmgrBytes},
+   {"libc", malloc, free, realloc, libcBytes},
+};
+
+/*--------------------------------------------------------------------*/
+
+static uint64_t nowNs(void)
+
+/* Return the monotonic time in nanoseconds. */
+
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Run stmt, timing it if it is the i-th call of the worker and i is sampled */
+#define TIMED(psWorker, stmt) do { \
+   if (((psWorker)->lDone++ & (LATENCY_SAMPLE - 1)) == 0 \
+       && (psWorker)->uiLatencies < (psWorker)->uiMaxLatencies) { \
+      uint64_t ulStart = nowNs(); \
+      stmt; \
+      (psWorker)->puiLatencies[(psWorker)->uiLatencies++] = (uint32_t)(nowNs() - ulStart); \
+   } \
+   else { \
+      stmt; \
+   } \
+} while (0)
+
+/*--------------------------------------------------------------------*/
+
+static void *allocate(Worker *psWorker, size_t uiSize)
+
+/* Allocate uiSize bytes, timed, and touch the region. */
+
+{
+   void *pv;
+
+   TIMED(psWorker, pv = psWorker->psAlloc->pfMalloc(uiSize));
+   if (pv == NULL) {
+      fprintf(stderr, "%s : out of memory\n", psWorker->psAlloc->pcName);
+      exit(EXIT_FAILURE);
+   }
+   *(char *)pv = (char)uiSize;
+   return pv;
+}
+
+/*--------------------------------------------------------------------*/
+
+static void release(Worker *psWorker, void *pv)
+
+/* Free the region, timed. */
+
+{
+   TIMED(psWorker, psWorker->psAlloc->pfFree(pv));
+}
+
+/*--------------------------------------------------------------------*/
+
+static size_t powerLawSize(unsigned int *puiSeed)
+
+/* Return a size from 16 bytes to 64 KB, the chance of exceeding a size being inversely
+   proportional to it, as in most programs. */
+
+{
+   int iShift = 0;
+
+   while (iShift < 12 && rand_r(puiSeed) % 2 == 0)
+      iShift++;
+   return ((size_t)16 << iShift) + (size_t)rand_r(puiSeed) % ((size_t)16 << iShift);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void runChurn(Worker *psWorker)
+
+/* Replace regions of a fixed size at random in a window of WINDOW of them. */
+
+{
+   void *apvWindow[WINDOW] = {NULL};
+   int i;
+
+   while (psWorker->lDone < psWorker->lOps) {
+      i = rand_r(&psWorker->uiSeed) % WINDOW;
+      if (apvWindow[i] != NULL) {
+         release(psWorker, apvWindow[i]);
+         apvWindow[i] = NULL;
+      }
+      else
+         apvWindow[i] = allocate(psWorker, psWorker->uiSize);
+   }
+
+   for (i = 0; i < WINDOW; i++)
+      psWorker->psAlloc->pfFree(apvWindow[i]);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void runPowerLaw(Worker *psWorker)
+
+/* Replace regions of power law distributed sizes at random in a window of WINDOW. */
+
+{
+   void *apvWindow[WINDOW] = {NULL};
+   int i;
+
+   while (psWorker->lDone < psWorker->lOps) {
+      i = rand_r(&psWorker->uiSeed) % WINDOW;
+      if (apvWindow[i] != NULL) {
+         release(psWorker, apvWindow[i]);
+         apvWindow[i] = NULL;
+      }
+      else
+         apvWindow[i] = allocate(psWorker, powerLawSize(&psWorker->uiSeed));
+   }
+
+   for (i = 0; i < WINDOW; i++)
+      psWorker->psAlloc->pfFree(apvWindow[i]);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void runRealloc(Worker *psWorker)
+
+/* Grow REALLOC_BUFFERS buffers by small steps, as strings and vectors grow, freeing each
+   once it reaches REALLOC_LIMIT bytes. */
+
+{
+   void *apvBuffers[REALLOC_BUFFERS] = {NULL};
+   size_t auiSizes[REALLOC_BUFFERS] = {0};
+   void *pv;
+   int i;
+
+   while (psWorker->lDone < psWorker->lOps) {
+      i = rand_r(&psWorker->uiSeed) % REALLOC_BUFFERS;
+      if (auiSizes[i] >= REALLOC_LIMIT) {
+         release(psWorker, apvBuffers[i]);
+         apvBuffers[i] = NULL;
+         auiSizes[i] = 0;
+         continue;
+      }
+
+      auiSizes[i] += 1 + (size_t)rand_r(&psWorker->uiSeed) % 256;
+      TIMED(psWorker, pv = psWorker->psAlloc->pfRealloc(apvBuffers[i], auiSizes[i]));
+      if (pv == NULL) {
+         fprintf(stderr, "%s : out of memory\n", psWorker->psAlloc->pcName);
+         exit(EXIT_FAILURE);
+      }
+      ((char *)pv)[auiSizes[i] - 1] = (char)i;
+      apvBuffers[i] = pv;
+   }
+
+   for (i = 0; i < REALLOC_BUFFERS; i++)
+      psWorker->psAlloc->pfFree(apvBuffers[i]);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void runProdCons(Worker *psWorker)
+
+/* Even threads allocate regions and pass them through a queue to the next odd thread,
+   which frees them : every region is freed by another thread than its own. */
+
+{
+   Queue *psQueue = &psWorker->psShared->asQueues[psWorker->iThread / 2];
+   unsigned int uiHead, uiTail;
+   long lRegions = psWorker->lOps / 2, l;
+
+   if (psWorker->iThread % 2 == 0) {
+      for (l = 0; l < lRegions; l++) {
+         uiHead = psQueue->uiHead;
+         while (uiHead - __atomic_load_n(&psQueue->uiTail, __ATOMIC_ACQUIRE) == QUEUE_SIZE)
+            sched_yield();
+         psQueue->apvSlots[uiHead % QUEUE_SIZE] = allocate(psWorker, powerLawSize(&psWorker->uiSeed) % 1024 + 1);
+         __atomic_store_n(&psQueue->uiHead, uiHead + 1, __ATOMIC_RELEASE);
+      }
+   }
+   else {
+      for (l = 0; l < lRegions; l++) {
+         uiTail = psQueue->uiTail;
+         while (__atomic_load_n(&psQueue->uiHead, __ATOMIC_ACQUIRE) == uiTail)
+            sched_yield();
+         release(psWorker, psQueue->apvSlots[uiTail % QUEUE_SIZE]);
+         __atomic_store_n(&psQueue->uiTail, uiTail + 1, __ATOMIC_RELEASE);
+      }
+   }
+}
+
+/*--------------------------------------------------------------------*/
+
+static void runXmalloc(Worker *psWorker)
+
+/* Like xmalloc-test : even threads allocate batches of regions and push them on a
+   shared stack, odd threads pop batches and free them, in any pairing. */
+
+{
+   Shared *psShared = psWorker->psShared;
+   Batch *psBatch;
+   long lBatches = psWorker->lOps / 2 / XMALLOC_BATCH, l;
+   int i;
+
+   if (psWorker->iThread % 2 == 0) {
+      for (l = 0; l < lBatches; l++) {
+         psBatch = allocate(psWorker, sizeof(Batch));
+         for (i = 0; i < XMALLOC_BATCH; i++)
+            psBatch->apvRegions[i] = allocate(psWorker, 16 + (size_t)rand_r(&psWorker->uiSeed) % 240);
+
+         pthread_mutex_lock(&psShared->sLock);
+         psBatch->psNext = psShared->psBatches;
+         psShared->psBatches = psBatch;
+         pthread_mutex_unlock(&psShared->sLock);
+      }
+
+      pthread_mutex_lock(&psShared->sLock);
+      psShared->iAllocatorsLeft--;
+      pthread_mutex_unlock(&psShared->sLock);
+      return;
+   }
+
+   for (;;) {
+      pthread_mutex_lock(&psShared->sLock);
+      psBatch = psShared->psBatches;
+      if (psBatch != NULL)
+         psShared->psBatches = psBatch->psNext;
+      else if (psShared->iAllocatorsLeft == 0) {
+         pthread_mutex_unlock(&psShared->sLock);
+         return;
+      }
+      pthread_mutex_unlock(&psShared->sLock);
+
+      if (psBatch == NULL) {
+         sched_yield();
+         continue;
+      }
+      for (i = 0; i < XMALLOC_BATCH; i++)
+         release(psWorker, psBatch->apvRegions[i]);
+      release(psWorker, psBatch);
+   }
+}
+
+/*--------------------------------------------------------------------*/
+
+static void runLarson(Worker *psWorker)
+
+/* Like the Larson server benchmark : a round of threads replaces regions at random in
+   windows inherited from the threads of the previous round, so most regions are freed
+   by another thread than the one that allocated them, and threads keep exiting. */
+
+{
+   void **ppvWindow = psWorker->psShared->appvLarson[(psWorker->iThread + psWorker->iRound) % psWorker->iThreads];
+   long lOps = psWorker->lDone + psWorker->lOps / LARSON_ROUNDS;
+   int i;
+
+   while (psWorker->lDone < lOps) {
+      i = rand_r(&psWorker->uiSeed) % WINDOW;
+      if (ppvWindow[i] != NULL)
+         release(psWorker, ppvWindow[i]);
+      ppvWindow[i] = allocate(psWorker, 16 + (size_t)rand_r(&psWorker->uiSeed) % 1008);
+   }
+}
+
+static const Scenario asScenarios[] = {
+   {"churn", runChurn, 0, "fixed size regions replaced at random"},
+   {"powerlaw", runPowerLaw, 0, "power law sizes replaced at random"},
+   {"realloc", runRealloc, 0, "buffers grown by realloc"},
+   {"prodcons", runProdCons, 1, "allocated by producers, freed by consumers"},
+   {"larson", runLarson, 0, "Larson server, regions inherited across threads"},
+   {"xmalloc", runXmalloc, 1, "xmalloc-test, batches freed by other threads"},
+};
+
+#define NUM_SCENARIOS (int)(sizeof(asScenarios) / sizeof(asScenarios[0]))
+#define NUM_ALLOCATORS (int)(sizeof(asAllocators) / sizeof(asAllocators[0]))
+
+/*--------------------------------------------------------------------*/
+
+static const Scenario *psRunning;
+static const Allocator *psMonitored;
+static int iMonitoring;
+static size_t uiPeakHeap;
+
+/*--------------------------------------------------------------------*/
+
+static void *monitor(void *pvArg)
+
+/* Sample the heap size of the allocator under test until told to stop. */
+
+{
+   size_t uiBytes;
+
+   (void)pvArg;
+   while (__atomic_load_n(&iMonitoring, __ATOMIC_ACQUIRE)) {
+      uiBytes = psMonitored->pfHeapBytes();
+      if (uiBytes > uiPeakHeap)
+         uiPeakHeap = uiBytes;
+      usleep(MONITOR_PERIOD);
+   }
+   return NULL;
+}
+
+/*--------------------------------------------------------------------*/
+
+static void *work(void *pvWorker)
+
+/* Run the scenario in a thread. */
+
+{
+   psRunning->pfRun(pvWorker);
+   return NULL;
+}
+
+/*--------------------------------------------------------------------*/
+
+static int compareLatencies(const void *pvA, const void *pvB)
+
+/* qsort comparison of two latencies. */
+
+{
+   uint32_t uiA = *(const uint32_t *)pvA, uiB = *(const uint32_t *)pvB;
+
+   return (uiA > uiB) - (uiA < uiB);
+}
+
+/*--------------------------------------------------------------------*/
+
+static void runScenario(const Scenario *psScenario, const Allocator *psAlloc, int iThreads,
+                        long lOps, size_t uiSize)
+
+/* Run the scenario on the allocator with iThreads threads of lOps allocator calls each,
+   and print a line of results. Meant to run in a process of its own. */
+
+{
+   static Worker asWorkers[MAX_THREADS];
+   pthread_t asThreads[MAX_THREADS], sMonitor;
+   Shared *psShared;
+   uint32_t *puiAll;
+   size_t uiCount = 0, uiPerThread, i;
+   long lDone = 0;
+   int t, iRound, iRounds = psScenario->pfRun == runLarson ? LARSON_ROUNDS : 1;
+   uint64_t ulStart, ulElapsed;
+   struct rusage sUsage;
+
+   /* The benchmark's own memory comes straight from the system, so that neither
+      allocator holds it */
+   uiPerThread = (size_t)lOps / LATENCY_SAMPLE + 1;
+   puiAll = mmap(NULL, uiPerThread * iThreads * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   psShared = mmap(NULL, sizeof(Shared) + iThreads * WINDOW * sizeof(void *),
+                   PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (puiAll == MAP_FAILED || psShared == MAP_FAILED) {
+      perror("mmap");
+      exit(EXIT_FAILURE);
+   }
+   pthread_mutex_init(&psShared->sLock, NULL);
+   psShared->iAllocatorsLeft = (iThreads + 1) / 2;
+   for (t = 0; t < iThreads; t++)
+      psShared->appvLarson[t] = (void **)(psShared + 1) + (size_t)t * WINDOW;
+
+   for (t = 0; t < iThreads; t++) {
+      asWorkers[t].psAlloc = psAlloc;
+      asWorkers[t].psShared = psShared;
+      asWorkers[t].iThread = t;
+      asWorkers[t].iThreads = iThreads;
+      asWorkers[t].lOps = lOps;
+      asWorkers[t].uiSize = uiSize;
+      asWorkers[t].uiSeed = (unsigned int)t + 1;
+      asWorkers[t].puiLatencies = puiAll + (size_t)t * uiPerThread;
+      asWorkers[t].uiMaxLatencies = uiPerThread;
+   }
+
+   psRunning = psScenario;
+   psMonitored = psAlloc;
+   iMonitoring = 1;
+   pthread_create(&sMonitor, NULL, monitor, NULL);
+
+   ulStart = nowNs();
+   for (iRound = 0; iRound < iRounds; iRound++) {
+      for (t = 0; t < iThreads; t++) {
+         asWorkers[t].iRound = iRound;
+         pthread_create(&asThreads[t], NULL, work, &asWorkers[t]);
+      }
+      for (t = 0; t < iThreads; t++)
+         pthread_join(asThreads[t], NULL);
+   }
+   ulElapsed = nowNs() - ulStart;
+
+   __atomic_store_n(&iMonitoring, 0, __ATOMIC_RELEASE);
+   pthread_join(sMonitor, NULL);
+
+   /* What larson leaves is freed outside of the timing */
+   if (psScenario->pfRun == runLarson)
+      for (i = 0; i < (size_t)iThreads * WINDOW; i++)
+         psAlloc->pfFree(psShared->appvLarson[0][i]);
+
+   /* Gather the latencies of all threads at the start of the array */
+   for (t = 0; t < iThreads; t++) {
+      memmove(puiAll + uiCount, asWorkers[t].puiLatencies, asWorkers[t].uiLatencies * sizeof(uint32_t));
+      uiCount += asWorkers[t].uiLatencies;
+      lDone += asWorkers[t].lDone;
+   }
+   qsort(puiAll, uiCount, sizeof(uint32_t), compareLatencies);
+
+   getrusage(RUSAGE_SELF, &sUsage);
+   printf("%-9s %-8s %3d %10ld %9.2f %7u %7u %8u %10ld %10zu\n", psScenario->pcName,
+          psAlloc->pcName, iThreads, lDone, lDone / (ulElapsed / 1e9) / 1e6,
+          uiCount == 0 ? 0 : puiAll[uiCount / 2],
+          uiCount == 0 ? 0 : puiAll[uiCount * 99 / 100],
+          uiCount == 0 ? 0 : puiAll[uiCount * 999 / 1000],
+          sUsage.ru_maxrss, uiPeakHeap >> 10);
+}
+
+/*--------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+
+/* Run the scenarios named on the command line, or all of them, on each allocator. */
+
+{
+   long lOps = 200000;
+   int iThreads = 4, iOpt, iRan = 0, s, a, iUsed;
+   size_t uiSize = 64;
+   const char *pcAllocator = "both";
+   pid_t iChild;
+
+   while ((iOpt = getopt(argc, argv, "n:t:s:a:")) != -1) {
+      switch (iOpt) {
+         case 'n' :
+            lOps = atol(optarg);
+            break;
+
+         case 't' :
+            iThreads = atoi(optarg);
+            break;
+
+         case 's' :
+            uiSize = (size_t)atol(optarg);
+            break;
+
+         case 'a' :
+            pcAllocator = optarg;
+            break;
+
+         default :
+            fprintf(stderr, "usage : %s [-n ops per thread] [-t threads] [-s size] "
+                    "[-a heapmgr|libc|both] [scenario ...]\n", argv[0]);
+            for (s = 0; s < NUM_SCENARIOS; s++)
+               fprintf(stderr, "   %-9s %s\n", asScenarios[s].pcName, asScenarios[s].pcDescription);
+            return EXIT_FAILURE;
+      }
+   }
+   if (lOps < 1 || uiSize < 1 || iThreads < 1 || iThreads > MAX_THREADS) {
+      fprintf(stderr, "Ops and size must be positive, threads from 1 to %d\n", MAX_THREADS);
+      return EXIT_FAILURE;
+   }
+
+   printf("%-9s %-8s %3s %10s %9s %7s %7s %8s %10s %10s\n", "scenario", "alloc", "thr",
+          "calls", "Mcalls/s", "p50 ns", "p99 ns", "p999 ns", "RSS KB", "heap KB");
+
+   for (s = 0; s < NUM_SCENARIOS; s++) {
+      if (optind < argc) {
+         for (a = optind; a < argc && strcmp(argv[a], asScenarios[s].pcName) != 0; a++)
+            ;
+         if (a == argc)
+            continue;
+      }
+      iRan++;
+
+      /* Producers and consumers come in pairs */
+      iUsed = asScenarios[s].iPaired ? (iThreads + 1) / 2 * 2 : iThreads;
+
+      for (a = 0; a < NUM_ALLOCATORS; a++) {
+         if (strcmp(pcAllocator, "both") != 0 && strcmp(pcAllocator, asAllocators[a].pcName) != 0)
+            continue;
+
+         fflush(stdout);
+         iChild = fork();
+         if (iChild == 0) {
+            runScenario(&asScenarios[s], &asAllocators[a], iUsed, lOps, uiSize);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+         }
+         if (iChild < 0 || waitpid(iChild, NULL, 0) < 0) {
+            perror("fork");
+            return EXIT_FAILURE;
+         }
+      }
+   }
+
+   if (iRan == 0) {
+      fprintf(stderr, "No such scenario\n");
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
@@ -17,20 +17,74 @@
 
 #include "chunk.h"
 #include <stddef.h>
-#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <assert.h>
 
 /*--------------------------------------------------------------------*/
 
+#define STATUS_BIT   1U
+/* Header bit storing the Chunk's status. */
+
+#define MAPPED_BIT   2U
+/* Header bit set if the Chunk has its own memory mapping. */
+
+#define ZEROED_BIT   4U
+/* Header bit set if the Chunk is known to be zero filled. */
+
+#define PREV_FREE_BIT   8U
+/* Header bit set if the previous Chunk in memory is free. */
+
+#define FLAG_BITS    4
+/* The number of low-order header bits used as flags. */
+
 typedef struct Chunk {
    size_t uiUnits;
-   /* The number of Units in the Chunk.  The low-order bit
-      stores the Chunk's status. */
+   /* The number of Units in the Chunk.  The low-order FLAG_BITS
+      bits of the header store the Chunk's flags. */
 
    Chunk_T AdjacentChunk;
-   /* The address of an adjacent Chunk. */
+   /* The address of an adjacent Chunk, or the start of the
+      mapping of a mapped Chunk. */
 }Chunk;
 
+typedef struct TreeLinks {
+   Chunk_T Child[2];
+   /* The left and right children of the Chunk in the tree. */
+
+   Chunk_T Parent;
+   /* The parent of the Chunk in the tree. */
+
+   size_t uiColor;
+   /* The red-black color of the Chunk. */
+}TreeLinks;
+/* The tree links of a free Chunk, stored in the two Units that
+   follow its header. */
+
+/*--------------------------------------------------------------------*/
+
+static TreeLinks *Chunk_getTreeLinks(Chunk_T Chunk)
+
+/* Return a pointer to the tree links stored in Chunk's body. */
+
+{
+   assert(Chunk != NULL);
+   assert(Chunk_getUnits(Chunk) >= MIN_UNITS_PER_TREE_CHUNK);
+
+   return (TreeLinks *)(Chunk + 1);
+}
+
+/*--------------------------------------------------------------------*/
+
+static size_t Chunk_getHeader(Chunk_T Chunk)
+
+/* Return the first word of Chunk's header: its number of units and
+   its flags. */
+
+{
+   return __atomic_load_n(&Chunk->uiUnits, __ATOMIC_RELAXED);
+}
+
 /*--------------------------------------------------------------------*/
 
 size_t Chunk_getUnitSize(void)
@@ -50,21 +104,25 @@ enum ChunkStatus Chunk_getStatus(Chunk_T Chunk)
 {
    assert(Chunk != NULL);
 
-   return Chunk->uiUnits & 1U;
+   return Chunk_getHeader(Chunk) & STATUS_BIT;
 }
 
 /*--------------------------------------------------------------------*/
 
 void Chunk_setStatus(Chunk_T Chunk, enum ChunkStatus eStatus)
 
-/* Set the status of Chunk to eStatus. */
+/* Set the status of Chunk to eStatus.  Chunk's number of units must
+   be set: a Chunk set free gets its footer. */
 
 {
    assert(Chunk != NULL);
    assert((eStatus == CHUNK_FREE) || (eStatus == CHUNK_INUSE));
 
-   Chunk->uiUnits &= ~1U;
+   Chunk->uiUnits &= ~(size_t)STATUS_BIT;
    Chunk->uiUnits |= eStatus;
+
+   if (eStatus == CHUNK_FREE)
+      (Chunk + Chunk_getUnits(Chunk) - 1)->uiUnits = Chunk_getUnits(Chunk);
 }
 
 /*--------------------------------------------------------------------*/
@@ -76,25 +134,132 @@ size_t Chunk_getUnits(Chunk_T Chunk)
 {
    assert(Chunk != NULL);
 
-   return Chunk->uiUnits >> 1;
+   return Chunk_getHeader(Chunk) >> FLAG_BITS;
 }
 
 /*--------------------------------------------------------------------*/
 
 void Chunk_setUnits(Chunk_T Chunk, size_t uiUnits)
 
-/* Set Chunk's number of units to uiUnits. */
+/* Set Chunk's number of units to uiUnits.  Chunk keeps its status
+   and its prev free bit but loses its other flags (e.g. its
+   mapping). */
 
 {
    assert(Chunk != NULL);
    assert(uiUnits >= MIN_UNITS_PER_CHUNK);
 
-   /* Set the Units in Chunk's header. */
-   Chunk->uiUnits &= 1U;
-   Chunk->uiUnits |= uiUnits << 1U;
+   /* Set the Units in Chunk's header, keeping its status and prev
+      free bit but clearing the other flags, which must be set
+      afterwards. */
+   Chunk->uiUnits &= STATUS_BIT | PREV_FREE_BIT;
+   Chunk->uiUnits |= uiUnits << FLAG_BITS;
+
+   /* Only a free Chunk has a footer. */
+   if (Chunk_getStatus(Chunk) == CHUNK_FREE)
+      (Chunk + uiUnits - 1)->uiUnits = uiUnits;
+}
+
+/*--------------------------------------------------------------------*/
+
+int Chunk_isPrevFree(Chunk_T Chunk)
+
+/* Return 1 (TRUE) if the previous Chunk in memory is free, or 0
+   (FALSE) if it is in use or there is none. */
+
+{
+   assert(Chunk != NULL);
+
+   return (Chunk_getHeader(Chunk) & PREV_FREE_BIT) != 0;
+}
+
+/*--------------------------------------------------------------------*/
+
+void Chunk_setPrevFree(Chunk_T Chunk, int iPrevFree)
+
+/* Record whether the previous Chunk in memory is free. */
+
+{
+   assert(Chunk != NULL);
+
+   /* The header of an in use Chunk is read without a lock by the
+      thread freeing it, while its neighbour's status changes. */
+   if (iPrevFree)
+      __atomic_fetch_or(&Chunk->uiUnits, PREV_FREE_BIT, __ATOMIC_RELAXED);
+   else
+      __atomic_fetch_and(&Chunk->uiUnits, ~(size_t)PREV_FREE_BIT, __ATOMIC_RELAXED);
+}
+
+/*--------------------------------------------------------------------*/
+
+int Chunk_isMapped(Chunk_T Chunk)
+
+/* Return 1 (TRUE) if Chunk has its own memory mapping, or 0 (FALSE)
+   if it is part of a heap. */
+
+{
+   assert(Chunk != NULL);
+
+   return (Chunk_getHeader(Chunk) & MAPPED_BIT) != 0;
+}
+
+/*--------------------------------------------------------------------*/
+
+void Chunk_setMapping(Chunk_T Chunk, void *pvMapping)
+
+/* Mark Chunk as having its own memory mapping starting at pvMapping.
+   The Chunk must extend to the end of the mapping. */
+
+{
+   assert(Chunk != NULL);
+   assert(pvMapping != NULL);
+   assert((char *)pvMapping <= (char *)Chunk);
+
+   Chunk->uiUnits |= MAPPED_BIT;
+   Chunk->AdjacentChunk = (Chunk_T)pvMapping;
+}
+
+/*--------------------------------------------------------------------*/
+
+void *Chunk_getMapping(Chunk_T Chunk)
+
+/* Return the start of the memory mapping of the mapped Chunk. */
+
+{
+   assert(Chunk != NULL);
+   assert(Chunk_isMapped(Chunk));
+
+   return Chunk->AdjacentChunk;
+}
+
+/*--------------------------------------------------------------------*/
+
+int Chunk_isZeroed(Chunk_T Chunk)
 
-   /* Set the Units in Chunk's footer. */
-   (Chunk + uiUnits - 1)->uiUnits = uiUnits;
+/* Return 1 (TRUE) if Chunk is known to be zero filled outside of its
+   header, the ZEROED_UNITS Units that follow it and its footer, or
+   0 (FALSE) otherwise. */
+
+{
+   assert(Chunk != NULL);
+
+   return (Chunk_getHeader(Chunk) & ZEROED_BIT) != 0;
+}
+
+/*--------------------------------------------------------------------*/
+
+void Chunk_setZeroed(Chunk_T Chunk, int iZeroed)
+
+/* Record whether Chunk is known to be zero filled outside of its
+   header, the ZEROED_UNITS Units that follow it and its footer. */
+
+{
+   assert(Chunk != NULL);
+
+   if (iZeroed)
+      Chunk->uiUnits |= ZEROED_BIT;
+   else
+      Chunk->uiUnits &= ~(size_t)ZEROED_BIT;
 }
 
 /*--------------------------------------------------------------------*/
@@ -149,6 +314,74 @@ void Chunk_setPrevInList(Chunk_T Chunk, Chunk_T PrevChunk)
 
 /*--------------------------------------------------------------------*/
 
+Chunk_T Chunk_getChild(Chunk_T Chunk, int iDir)
+
+/* Return Chunk's left (iDir == 0) or right (iDir == 1) child in the
+   tree, or NULL if there is no such child. */
+
+{
+   assert((iDir == 0) || (iDir == 1));
+
+   return Chunk_getTreeLinks(Chunk)->Child[iDir];
+}
+
+/*--------------------------------------------------------------------*/
+
+void Chunk_setChild(Chunk_T Chunk, int iDir, Chunk_T Child)
+
+/* Set Chunk's left (iDir == 0) or right (iDir == 1) child in the tree
+   to Child. */
+
+{
+   assert((iDir == 0) || (iDir == 1));
+
+   Chunk_getTreeLinks(Chunk)->Child[iDir] = Child;
+}
+
+/*--------------------------------------------------------------------*/
+
+Chunk_T Chunk_getParent(Chunk_T Chunk)
+
+/* Return Chunk's parent in the tree, or NULL if Chunk is the root. */
+
+{
+   return Chunk_getTreeLinks(Chunk)->Parent;
+}
+
+/*--------------------------------------------------------------------*/
+
+void Chunk_setParent(Chunk_T Chunk, Chunk_T Parent)
+
+/* Set Chunk's parent in the tree to Parent. */
+
+{
+   Chunk_getTreeLinks(Chunk)->Parent = Parent;
+}
+
+/*--------------------------------------------------------------------*/
+
+enum ChunkColor Chunk_getColor(Chunk_T Chunk)
+
+/* Return the color of Chunk as a tree node. */
+
+{
+   return (enum ChunkColor)Chunk_getTreeLinks(Chunk)->uiColor;
+}
+
+/*--------------------------------------------------------------------*/
+
+void Chunk_setColor(Chunk_T Chunk, enum ChunkColor eColor)
+
+/* Set the color of Chunk as a tree node to eColor. */
+
+{
+   assert((eColor == CHUNK_RED) || (eColor == CHUNK_BLACK));
+
+   Chunk_getTreeLinks(Chunk)->uiColor = eColor;
+}
+
+/*--------------------------------------------------------------------*/
+
 Chunk_T Chunk_getNextInMem(Chunk_T Chunk, Chunk_T HeapEnd)
 
 /* Return Chunk's next Chunk in memory, or NULL if there is no
@@ -175,27 +408,41 @@ Chunk_T Chunk_getNextInMem(Chunk_T Chunk, Chunk_T HeapEnd)
 
 Chunk_T Chunk_getPrevInMem(Chunk_T Chunk, Chunk_T HeapStart)
 
-/* Return Chunk's previous Chunk in memory, or NULL if there is no
-   previous Chunk. Use HeapStart to determine if there is no
-   previous Chunk. The previous Chunk's number of units must be set
-   properly for this function to work. */
+/* Return Chunk's previous Chunk in memory if it is free, or NULL if
+   it is in use or there is no previous Chunk. Use HeapStart to
+   determine if there is no previous Chunk. Only a free Chunk has
+   the footer this function reads. */
 
 {  
    assert(HeapStart != NULL);
    assert(Chunk != NULL);
    assert(Chunk >= HeapStart);
 
-   size_t UnitSize = Chunk_getUnitSize();
-   Chunk_T PrevChunk;
-
-   if (Chunk == HeapStart)
+   if (Chunk == HeapStart || !Chunk_isPrevFree(Chunk))
       return NULL;
 
-   Chunk_T PrevFooter = (Chunk_T)((char *)Chunk - UnitSize);
-   size_t PrevSize = PrevFooter->uiUnits;
+   return Chunk_getFreeBefore(Chunk, HeapStart);
+}
+
+/*--------------------------------------------------------------------*/
+
+Chunk_T Chunk_getFreeBefore(Chunk_T End, Chunk_T HeapStart)
+
+/* Return the free Chunk that ends at End, found through its footer.
+   End may be the end of the heap, where there is no header to
+   tell whether the last Chunk is free. */
 
-   PrevChunk = Chunk - PrevSize;
+{
+   size_t UnitSize = Chunk_getUnitSize();
+   Chunk_T PrevFooter, PrevChunk;
+
+   assert(End != NULL);
+   assert(End > HeapStart);
+
+   PrevFooter = (Chunk_T)((char *)End - UnitSize);
+   PrevChunk = End - PrevFooter->uiUnits;
    assert(PrevChunk >= HeapStart);
+   assert(Chunk_getStatus(PrevChunk) == CHUNK_FREE);
 
    return PrevChunk;
 }
@@ -214,6 +461,18 @@ size_t Chunk_getFooterUnits(Chunk_T Chunk)
 
 /*--------------------------------------------------------------------*/
 
+static void Chunk_reportError(const char *pcMessage)
+
+/* Write pcMessage to the standard error with write(2) : stdio may
+   allocate, which would reenter the heap manager when it replaces
+   malloc. */
+
+{
+   (void)!write(STDERR_FILENO, pcMessage, strlen(pcMessage));
+}
+
+/*--------------------------------------------------------------------*/
+
 int Chunk_isValid(Chunk_T Chunk, Chunk_T HeapStart, Chunk_T HeapEnd)
 
 /* Return 1 (TRUE) if Chunk is valid, notably with respect to
@@ -225,16 +484,17 @@ int Chunk_isValid(Chunk_T Chunk, Chunk_T HeapStart, Chunk_T HeapEnd)
    assert(HeapEnd != NULL);
 
    if (Chunk < HeapStart)
-      {fprintf(stderr, "Bad heap start\n"); return 0; }
+      {Chunk_reportError("Bad heap start\n"); return 0; }
    if (Chunk >= HeapEnd)
-      {fprintf(stderr, "Bad heap end\n"); return 0; }
+      {Chunk_reportError("Bad heap end\n"); return 0; }
    if (Chunk_getUnits(Chunk) == 0)
-      {fprintf(stderr, "Zero units\n"); return 0; }
+      {Chunk_reportError("Zero units\n"); return 0; }
    if (Chunk_getUnits(Chunk) < MIN_UNITS_PER_CHUNK)
-      {fprintf(stderr, "Bad size\n"); return 0; }
+      {Chunk_reportError("Bad size\n"); return 0; }
    if (Chunk + Chunk_getUnits(Chunk) > HeapEnd)
-      {fprintf(stderr, "Bad chunk end\n"); return 0; }
-   if (Chunk_getUnits(Chunk) != Chunk_getFooterUnits(Chunk))
-      {fprintf(stderr, "Inconsistent sizes\n"); return 0; }
+      {Chunk_reportError("Bad chunk end\n"); return 0; }
+   if (Chunk_getStatus(Chunk) == CHUNK_FREE &&
+       Chunk_getUnits(Chunk) != Chunk_getFooterUnits(Chunk))
+      {Chunk_reportError("Inconsistent sizes\n"); return 0; }
    return 1;
 }
\ No newline at end of file
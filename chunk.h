@@ -23,19 +23,28 @@
 enum ChunkStatus {CHUNK_FREE, CHUNK_INUSE};
 /* A Chunk can be either free or in use. */
 
+enum ChunkColor {CHUNK_RED, CHUNK_BLACK};
+/* A free Chunk that is a node of a size-keyed red-black tree is
+   either red or black. */
+
 typedef struct Chunk *Chunk_T;
 
 /* A Chunk is a sequence of Units.
    The first Unit is a header that indicates the number of Units in the
-   Chunk, whether the Chunk is free, and, if the Chunk is free, a
-   pointer to the next Chunk in the free list.  The last Unit is a
-   footer that indicates the number of Units in the Chunk and, if the
-   Chunk is free, a pointer to the previous Chunk in the free list.
-   The Units between the header and footer store client data. */
+   Chunk, whether the Chunk is free, whether the previous Chunk in
+   memory is free, and, if the Chunk is free, a pointer to the next
+   Chunk in the free list.  A free Chunk's last Unit is a footer that
+   indicates the number of Units in the Chunk and a pointer to the
+   previous Chunk in the free list.  An in use Chunk has no footer:
+   the Units after its header store client data. */
 
 #define MIN_UNITS_PER_CHUNK   3
 /* The minimum number of units that a Chunk can contain. */
 
+#define MIN_UNITS_PER_TREE_CHUNK   4
+/* The minimum number of units that a free Chunk must contain to be
+   a tree node: its tree links occupy the two Units after the header. */
+
 size_t Chunk_getUnitSize(void);
 /* Return the number of bytes in a Unit. */
 
@@ -43,13 +52,47 @@ enum ChunkStatus Chunk_getStatus(Chunk_T Chunk);
 /* Return the status of Chunk. */
 
 void Chunk_setStatus(Chunk_T Chunk, enum ChunkStatus eStatus);
-/* Set the status of Chunk to eStatus. */
+/* Set the status of Chunk to eStatus.  Chunk's number of units must
+   be set: a Chunk set free gets its footer. */
 
 size_t Chunk_getUnits(Chunk_T Chunk);
 /* Return Chunk's number of units. */
 
 void Chunk_setUnits(Chunk_T Chunk, size_t uiUnits);
-/* Set Chunk's number of units to uiUnits. */
+/* Set Chunk's number of units to uiUnits.  Chunk keeps its status
+   and its prev free bit but loses its other flags (e.g. its
+   mapping). */
+
+int Chunk_isPrevFree(Chunk_T Chunk);
+/* Return 1 (TRUE) if the previous Chunk in memory is free, or 0
+   (FALSE) if it is in use or there is none. */
+
+void Chunk_setPrevFree(Chunk_T Chunk, int iPrevFree);
+/* Record whether the previous Chunk in memory is free. */
+
+int Chunk_isMapped(Chunk_T Chunk);
+/* Return 1 (TRUE) if Chunk has its own memory mapping, or 0 (FALSE)
+   if it is part of a heap. */
+
+void Chunk_setMapping(Chunk_T Chunk, void *pvMapping);
+/* Mark Chunk as having its own memory mapping starting at pvMapping.
+   The Chunk must extend to the end of the mapping. */
+
+void *Chunk_getMapping(Chunk_T Chunk);
+/* Return the start of the memory mapping of the mapped Chunk. */
+
+#define ZEROED_UNITS   (MIN_UNITS_PER_TREE_CHUNK - 2)
+/* The number of Units after the header of a zeroed Chunk that may
+   still hold links from its time in a free list or tree. */
+
+int Chunk_isZeroed(Chunk_T Chunk);
+/* Return 1 (TRUE) if Chunk is known to be zero filled outside of its
+   header, the ZEROED_UNITS Units that follow it and its footer, or
+   0 (FALSE) otherwise. */
+
+void Chunk_setZeroed(Chunk_T Chunk, int iZeroed);
+/* Record whether Chunk is known to be zero filled outside of its
+   header, the ZEROED_UNITS Units that follow it and its footer. */
 
 Chunk_T Chunk_getNextInList(Chunk_T Chunk);
 /* Return Chunk's next Chunk in the free list, or NULL if there
@@ -65,6 +108,26 @@ Chunk_T Chunk_getPrevInList(Chunk_T Chunk);
 void Chunk_setPrevInList(Chunk_T Chunk, Chunk_T oPrevChunk);
 /* Set Chunk's previous Chunk in the free list to oPrevChunk. */
 
+Chunk_T Chunk_getChild(Chunk_T Chunk, int iDir);
+/* Return Chunk's left (iDir == 0) or right (iDir == 1) child in the
+   tree, or NULL if there is no such child. */
+
+void Chunk_setChild(Chunk_T Chunk, int iDir, Chunk_T oChild);
+/* Set Chunk's left (iDir == 0) or right (iDir == 1) child in the tree
+   to oChild. */
+
+Chunk_T Chunk_getParent(Chunk_T Chunk);
+/* Return Chunk's parent in the tree, or NULL if Chunk is the root. */
+
+void Chunk_setParent(Chunk_T Chunk, Chunk_T oParent);
+/* Set Chunk's parent in the tree to oParent. */
+
+enum ChunkColor Chunk_getColor(Chunk_T Chunk);
+/* Return the color of Chunk as a tree node. */
+
+void Chunk_setColor(Chunk_T Chunk, enum ChunkColor eColor);
+/* Set the color of Chunk as a tree node to eColor. */
+
 Chunk_T Chunk_getNextInMem(Chunk_T Chunk, Chunk_T oHeapEnd);
 /* Return Chunk's next Chunk in memory, or NULL if there is no
    next Chunk.  Use oHeapEnd to determine if there is no next
@@ -72,10 +135,15 @@ Chunk_T Chunk_getNextInMem(Chunk_T Chunk, Chunk_T oHeapEnd);
    function to work. */
 
 Chunk_T Chunk_getPrevInMem(Chunk_T Chunk, Chunk_T oHeapStart);
-/* Return Chunk's previous Chunk in memory, or NULL if there is no
-   previous Chunk.  Use oHeapStart to determine if there is no
-   previous Chunk.  The previous Chunk's number of units must be set
-   properly for this function to work. */
+/* Return Chunk's previous Chunk in memory if it is free, or NULL if
+   it is in use or there is no previous Chunk.  Use oHeapStart to
+   determine if there is no previous Chunk.  Only a free Chunk has
+   the footer this function reads. */
+
+Chunk_T Chunk_getFreeBefore(Chunk_T oEnd, Chunk_T oHeapStart);
+/* Return the free Chunk that ends at oEnd, found through its footer.
+   oEnd may be the end of the heap, where there is no header to
+   tell whether the last Chunk is free. */
 
 int Chunk_isValid(Chunk_T Chunk, Chunk_T oHeapStart, Chunk_T oHeapEnd);
 /* Return 1 (TRUE) if Chunk is valid, notably with respect to
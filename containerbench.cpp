@@ -0,0 +1,244 @@
+/*****************************************************************************
+*    This file is part of project.
+*
+*    project is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    project is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with project.  If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/* Benchmarks of node-based standard containers on std::allocator (the C
+   library's malloc), on HeapMgrAllocator and on std::pmr containers over
+   HeapMgr_resource(). Each run fills a container, looks every element up
+   and erases them all in another order, and the best of the repeats is
+   printed as throughput over the inserts, lookups and erases.
+
+   usage : containerbench [-n elements] [-r repeats] */
+
+#include "heapmngr.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <list>
+#include <map>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+/* The strings are longer than the small string buffer, so each one allocates */
+#define STRING_LENGTH 40
+
+/*--------------------------------------------------------------------*/
+
+template <class T>
+using HeapMgrList = std::list<T, HeapMgrAllocator<T>>;
+
+template <class K, class V>
+using HeapMgrMap = std::map<K, V, std::less<K>, HeapMgrAllocator<std::pair<const K, V>>>;
+
+template <class K, class V>
+using HeapMgrUnorderedMap = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+                                               HeapMgrAllocator<std::pair<const K, V>>>;
+
+typedef std::basic_string<char, std::char_traits<char>, HeapMgrAllocator<char>> HeapMgrString;
+
+/*--------------------------------------------------------------------*/
+
+static std::uint64_t nowNs()
+
+/* Return a monotonic time in nanoseconds. */
+
+{
+   return (std::uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*--------------------------------------------------------------------*/
+
+template <class List>
+static std::uint64_t runList(List oList, const std::vector<int> &aiKeys)
+
+/* Push every key at the back, erase every other element, push the first
+   half of the keys again at the front, then empty the list. Returns the
+   time taken in nanoseconds. */
+
+{
+   std::uint64_t ulStart = nowNs();
+   std::size_t i;
+
+   for (int iKey : aiKeys)
+      oList.push_back(iKey);
+   for (auto it = oList.begin(); it != oList.end(); ) {
+      it = oList.erase(it);
+      if (it != oList.end())
+         ++it;
+   }
+   for (i = 0; i < aiKeys.size() / 2; i++)
+      oList.push_front(aiKeys[i]);
+   oList.clear();
+
+   return nowNs() - ulStart;
+}
+
+/*--------------------------------------------------------------------*/
+
+template <class Map, class Key>
+static std::uint64_t runMap(Map oMap, const std::vector<Key> &aoKeys,
+                            const std::vector<std::size_t> &auiOrder)
+
+/* Insert every key, look each one up, then erase them in auiOrder.
+   Returns the time taken in nanoseconds, or exits if a key is lost. */
+
+{
+   std::uint64_t ulStart = nowNs();
+   std::size_t uiFound = 0, i;
+
+   for (i = 0; i < aoKeys.size(); i++)
+      oMap.emplace(aoKeys[i], (int)i);
+   for (const Key &oKey : aoKeys)
+      uiFound += oMap.count(oKey);
+   for (std::size_t uiIndex : auiOrder)
+      oMap.erase(aoKeys[uiIndex]);
+
+   if (uiFound != aoKeys.size() || !oMap.empty()) {
+      std::fprintf(stderr, "Lost keys\n");
+      std::exit(EXIT_FAILURE);
+   }
+   return nowNs() - ulStart;
+}
+
+/*--------------------------------------------------------------------*/
+
+template <class Run>
+static void report(const char *pcContainer, const char *pcAllocator, std::size_t uiOps,
+                   int iRepeats, Run fRun)
+
+/* Run fRun iRepeats times and print the best throughput over uiOps
+   operations. */
+
+{
+   std::uint64_t ulBest = ~(std::uint64_t)0, ulTime;
+   int r;
+
+   for (r = 0; r < iRepeats; r++) {
+      ulTime = fRun();
+      ulBest = std::min(ulBest, ulTime);
+   }
+
+   std::printf("%-14s %-8s %10zu %9.2f %8.1f\n", pcContainer, pcAllocator, uiOps,
+               uiOps / (ulBest / 1e9) / 1e6, (double)ulBest / uiOps);
+}
+
+/*--------------------------------------------------------------------*/
+
+template <class String>
+static std::vector<String> makeStrings(const std::vector<int> &aiKeys)
+
+/* Return a string of STRING_LENGTH characters for each key. */
+
+{
+   std::vector<String> aoStrings;
+   char acBuffer[STRING_LENGTH + 1];
+
+   for (int iKey : aiKeys) {
+      std::snprintf(acBuffer, sizeof(acBuffer), "%0*d", STRING_LENGTH, iKey);
+      aoStrings.emplace_back(acBuffer);
+   }
+   return aoStrings;
+}
+
+/*--------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+
+/* Run every container on every allocator. */
+
+{
+   std::size_t uiCount = 200000, uiOps;
+   int iRepeats = 5, iOpt;
+   std::pmr::memory_resource *psResource = HeapMgr_resource();
+
+   while ((iOpt = getopt(argc, argv, "n:r:")) != -1) {
+      switch (iOpt) {
+         case 'n' :
+            uiCount = (std::size_t)std::atol(optarg);
+            break;
+
+         case 'r' :
+            iRepeats = std::atoi(optarg);
+            break;
+
+         default :
+            std::fprintf(stderr, "usage : %s [-n elements] [-r repeats]\n", argv[0]);
+            return EXIT_FAILURE;
+      }
+   }
+   if (uiCount < 1 || iRepeats < 1) {
+      std::fprintf(stderr, "Elements and repeats must be positive\n");
+      return EXIT_FAILURE;
+   }
+
+   /* Distinct keys in random order, and another order to erase them in */
+   std::vector<int> aiKeys(uiCount);
+   std::vector<std::size_t> auiOrder(uiCount);
+   std::mt19937 oRandom(42);
+   for (std::size_t i = 0; i < uiCount; i++) {
+      aiKeys[i] = (int)i;
+      auiOrder[i] = i;
+   }
+   std::shuffle(aiKeys.begin(), aiKeys.end(), oRandom);
+   std::shuffle(auiOrder.begin(), auiOrder.end(), oRandom);
+
+   std::vector<std::string> aoStdStrings = makeStrings<std::string>(aiKeys);
+   std::vector<HeapMgrString> aoHeapMgrStrings = makeStrings<HeapMgrString>(aiKeys);
+   std::vector<std::pmr::string> aoPmrStrings;
+   for (const std::string &oString : aoStdStrings)
+      aoPmrStrings.emplace_back(oString, psResource);
+
+   std::printf("%-14s %-8s %10s %9s %8s\n", "container", "alloc", "ops", "Mops/s", "ns/op");
+
+   uiOps = uiCount * 2;
+   report("list", "std", uiOps, iRepeats, [&] {
+      return runList(std::list<int>(), aiKeys); });
+   report("list", "heapmgr", uiOps, iRepeats, [&] {
+      return runList(HeapMgrList<int>(), aiKeys); });
+   report("list", "pmr", uiOps, iRepeats, [&] {
+      return runList(std::pmr::list<int>(psResource), aiKeys); });
+
+   uiOps = uiCount * 3;
+   report("map", "std", uiOps, iRepeats, [&] {
+      return runMap(std::map<int, int>(), aiKeys, auiOrder); });
+   report("map", "heapmgr", uiOps, iRepeats, [&] {
+      return runMap(HeapMgrMap<int, int>(), aiKeys, auiOrder); });
+   report("map", "pmr", uiOps, iRepeats, [&] {
+      return runMap(std::pmr::map<int, int>(psResource), aiKeys, auiOrder); });
+
+   report("unordered_map", "std", uiOps, iRepeats, [&] {
+      return runMap(std::unordered_map<int, int>(), aiKeys, auiOrder); });
+   report("unordered_map", "heapmgr", uiOps, iRepeats, [&] {
+      return runMap(HeapMgrUnorderedMap<int, int>(), aiKeys, auiOrder); });
+   report("unordered_map", "pmr", uiOps, iRepeats, [&] {
+      return runMap(std::pmr::unordered_map<int, int>(psResource), aiKeys, auiOrder); });
+
+   /* The keys are copied into the nodes, so each insert allocates a node and a string */
+   report("string map", "std", uiOps, iRepeats, [&] {
+      return runMap(std::map<std::string, int>(), aoStdStrings, auiOrder); });
+   report("string map", "heapmgr", uiOps, iRepeats, [&] {
+      return runMap(HeapMgrMap<HeapMgrString, int>(), aoHeapMgrStrings, auiOrder); });
+   report("string map", "pmr", uiOps, iRepeats, [&] {
+      return runMap(std::pmr::map<std::pmr::string, int>(psResource), aoPmrStrings, auiOrder); });
+
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*****************************************************************************
+*    This file is part of project.
+*
+*    project is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    project is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with project.  If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/* Checks the C++ adapters of heapmngr.hpp for make check : containers on
+   HeapMgrAllocator and on std::pmr containers over HeapMgr_resource() keep
+   their elements and give all their memory back, and over-aligned requests
+   are aligned. Exits with 1 if any check failed.
+
+   usage : heapcheck-cpp */
+
+#include "heapmngr.hpp"
+#include <cstdio>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Elements each container check inserts */
+#define ELEMENTS       10000
+
+static int iFailures;
+
+/*--------------------------------------------------------------------*/
+#define CHECK(i) check(i, #i, __LINE__)
+
+static void check(bool bSuccessful, const char *pcTest, int iLineNum)
+
+/* If !bSuccessful, print the test at line iLineNum and count it as
+   failed. */
+
+{
+   if (! bSuccessful) {
+      std::fprintf(stderr, "Check at line %d failed : %s\n", iLineNum, pcTest);
+      iFailures++;
+   }
+}
+
+/*--------------------------------------------------------------------*/
+
+static std::size_t inUseBytes()
+
+/* Return the bytes of the regions allocated and not freed yet. */
+
+{
+   struct HeapMgrStats sStats;
+
+   my_heap_stats(&sStats);
+   return sStats.uiInUseBytes;
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkAllocator()
+
+/* Standard containers on HeapMgrAllocator keep their elements and free
+   everything they allocated. */
+
+{
+   typedef std::basic_string<char, std::char_traits<char>, HeapMgrAllocator<char>> String;
+   std::size_t uiBefore = inUseBytes();
+
+   {
+      std::vector<int, HeapMgrAllocator<int>> aiValues;
+      std::list<String, HeapMgrAllocator<String>> oStrings;
+      std::map<int, String, std::less<int>, HeapMgrAllocator<std::pair<const int, String>>> oMap;
+      bool bOk = true;
+
+      for (int i = 0; i < ELEMENTS; i++) {
+         aiValues.push_back(i);
+         oStrings.push_back(String(40, (char)('a' + i % 26)));
+         oMap.emplace(i, String(40, (char)('a' + i % 26)));
+      }
+      for (int i = 0; i < ELEMENTS; i++)
+         if (aiValues[i] != i || oMap[i] != String(40, (char)('a' + i % 26)))
+            bOk = false;
+      CHECK(bOk);
+      CHECK(HeapMgrAllocator<int>() == HeapMgrAllocator<String>());
+   }
+
+   CHECK(inUseBytes() == uiBefore);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkResource()
+
+/* std::pmr containers over HeapMgr_resource() keep their elements and free
+   everything they allocated, and the resource honours over-aligned
+   requests. */
+
+{
+   std::pmr::memory_resource *psResource = HeapMgr_resource();
+   HeapMgrResource oOther;
+   std::size_t uiBefore = inUseBytes();
+
+   {
+      std::pmr::vector<std::pmr::string> aoStrings(psResource);
+      std::pmr::map<int, int> oMap(psResource);
+      bool bOk = true;
+
+      for (int i = 0; i < ELEMENTS; i++) {
+         aoStrings.emplace_back(40, (char)('a' + i % 26));
+         oMap.emplace(i, -i);
+      }
+      for (int i = 0; i < ELEMENTS; i++)
+         if (aoStrings[i] != std::pmr::string(40, (char)('a' + i % 26)) || oMap[i] != -i)
+            bOk = false;
+      CHECK(bOk);
+   }
+   CHECK(inUseBytes() == uiBefore);
+
+   for (std::size_t uiAlign = 1; uiAlign <= 4096; uiAlign *= 2) {
+      for (std::size_t uiBytes = 1; uiBytes <= 5000; uiBytes *= 7) {
+         void *pvRegion = psResource->allocate(uiBytes, uiAlign);
+         CHECK((std::uintptr_t)pvRegion % uiAlign == 0);
+         psResource->deallocate(pvRegion, uiBytes, uiAlign);
+      }
+   }
+   CHECK(inUseBytes() == uiBefore);
+
+   CHECK(psResource->is_equal(oOther));
+   CHECK(!psResource->is_equal(*std::pmr::new_delete_resource()));
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+int main()
+
+/* Run every check at the full check level and report the failures. */
+
+{
+   HeapMgr_setCheckLevel(HEAPMGR_CHECK_FULL, 0);
+
+   checkAllocator();
+   checkResource();
+   std::printf("%-24s %s\n", "c++ adapters", iFailures == 0 ? "ok" : "FAILED");
+
+   return iFailures != 0;
+}
@@ -0,0 +1,914 @@
+/*****************************************************************************
+*    This file is part of project.
+*
+*    project is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    project is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with project.  If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/* Checks the heap manager without any input, for make check. Each check exercises one
+   feature, with the whole heap checked on every call, and the checks run in order on
+   the same heap. Prints each check's result and exits with 1 if any failed.
+
+   usage : heapcheck */
+
+#include "heapmngr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <pthread.h>
+
+/* Bytes of a unit, the granularity of chunks */
+#define UNIT_SIZE      16
+
+/* The number of units of the chunk holding a region */
+#define REGION_UNITS(p) (my_malloc_usable_size(p) / UNIT_SIZE + 1)
+
+enum {FALSE, TRUE};
+
+static int iFailures;
+
+/*--------------------------------------------------------------------*/
+#define CHECK(i) check(i, #i, __LINE__)
+
+static void check(int iSuccessful, const char *pcTest, int iLineNum)
+
+/* If !iSuccessful, print the test at line iLineNum and count it as failed. */
+
+{
+   if (! iSuccessful) {
+      fprintf(stderr, "Check at line %d failed : %s\n", iLineNum, pcTest);
+      iFailures++;
+   }
+}
+/*--------------------------------------------------------------------*/
+
+static int isInside(void *pvRegion, void *pvChunk, size_t uiSize)
+
+/* Return TRUE if pvRegion lies in the uiSize bytes at pvChunk. */
+
+{
+   return (char *)pvRegion >= (char *)pvChunk && (char *)pvRegion < (char *)pvChunk + uiSize;
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkBinBitmap()
+
+/* Free a chunk between two in use ones, then ask for a size whose bin and every bin up
+   to the free chunk's are empty : the bitmap must lead my_malloc to that chunk. */
+
+{
+   struct HeapMgrStats sStats;
+   void *pvBefore, *pvChunk, *pvAfter, *pvRegion;
+   size_t uiUnits, uiRequest;
+
+   pvBefore = my_malloc(2000);
+   pvChunk = my_malloc(8000);
+   pvAfter = my_malloc(2000);
+   uiUnits = REGION_UNITS(pvChunk);
+   my_free(pvChunk);
+
+   my_heap_stats(&sStats);
+   CHECK(sStats.auiBinChunks[uiUnits] >= 1);
+   for (uiRequest = uiUnits - 1; uiRequest > 100 && sStats.auiBinChunks[uiRequest] == 0; uiRequest--)
+      ;
+   uiRequest++;
+   CHECK(uiRequest < uiUnits - 10);
+
+   pvRegion = my_malloc((uiRequest - 1) * UNIT_SIZE);
+   CHECK(isInside(pvRegion, pvChunk, 8000));
+   CHECK(HeapMgr_isValid());
+
+   my_free(pvRegion);
+   my_free(pvBefore);
+   my_free(pvAfter);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+/* The flag of a chunk's header telling that the chunk before it is free */
+#define PREV_FREE_FLAG 8
+
+/* Number of large chunks the tree check frees in a random order */
+#define TREE_CHUNKS    200
+
+void checkLargeBinTree()
+
+/* Free large chunks of random sizes in a random order, so that the tree of the last bin
+   is rebalanced many times, then check that requests take the best fitting chunk. */
+
+{
+   static void *apvChunks[TREE_CHUNKS], *apvGuards[TREE_CHUNKS];
+   static const size_t auiSizes[] = {20000, 40000, 60000, 80000};
+   void *apvBest[4], *apvBestGuards[4], *pvRegion;
+   int i, j;
+
+   srand(2);
+   for (i = 0; i < TREE_CHUNKS; i++) {
+      apvChunks[i] = my_malloc((size_t)(rand() % 80000) + 17000);
+      apvGuards[i] = my_malloc(2000);
+   }
+   for (i = TREE_CHUNKS - 1; i > 0; i--) {
+      j = rand() % (i + 1);
+      pvRegion = apvChunks[i];
+      apvChunks[i] = apvChunks[j];
+      apvChunks[j] = pvRegion;
+   }
+   for (i = 0; i < TREE_CHUNKS; i++)
+      my_free(apvChunks[i]);
+   CHECK(HeapMgr_isValid());
+   for (i = 0; i < TREE_CHUNKS; i++)
+      apvChunks[i] = my_malloc((size_t)(rand() % 80000) + 17000);
+   for (i = 0; i < TREE_CHUNKS; i++) {
+      my_free(apvChunks[i]);
+      my_free(apvGuards[i]);
+   }
+   CHECK(HeapMgr_isValid());
+
+   for (i = 0; i < 4; i++) {
+      apvBest[i] = my_malloc(auiSizes[i]);
+      apvBestGuards[i] = my_malloc(2000);
+   }
+   my_free(apvBest[1]);
+   my_free(apvBest[3]);
+   my_free(apvBest[0]);
+   my_free(apvBest[2]);
+
+   pvRegion = my_malloc(50000);
+   CHECK(isInside(pvRegion, apvBest[2], auiSizes[2]));
+   my_free(pvRegion);
+   pvRegion = my_malloc(70000);
+   CHECK(isInside(pvRegion, apvBest[3], auiSizes[3]));
+   my_free(pvRegion);
+
+   for (i = 0; i < 4; i++)
+      my_free(apvBestGuards[i]);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkLifoBins()
+
+/* Free two chunks of the same size : the bin must hand the last one freed back first. */
+
+{
+   void *pvFirst, *pvSecond, *apvGuards[2];
+
+   pvFirst = my_malloc(3000);
+   apvGuards[0] = my_malloc(2000);
+   pvSecond = my_malloc(3000);
+   apvGuards[1] = my_malloc(2000);
+
+   my_free(pvFirst);
+   my_free(pvSecond);
+   CHECK(my_malloc(3000) == pvSecond);
+   CHECK(my_malloc(3000) == pvFirst);
+
+   my_free(pvFirst);
+   my_free(pvSecond);
+   my_free(apvGuards[0]);
+   my_free(apvGuards[1]);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+static int abortsOnCorruption(enum HeapMgrCheckLevel eLevel)
+
+/* In a child process, flag the chunk after an in use chunk as following a free one, then
+   allocate and free a chunk elsewhere at check level eLevel. Return TRUE if the child
+   aborted, which only checking the whole heap can make it do. */
+
+{
+   void *pvInUse, *pvNext;
+   pid_t iPid;
+   int iStatus, iNull;
+
+   pvInUse = my_malloc(3000);
+   pvNext = my_malloc(3000);
+
+   iPid = fork();
+   if (iPid == 0) {
+      iNull = open("/dev/null", O_WRONLY);
+      dup2(iNull, 2);
+      HeapMgr_setCheckLevel(eLevel, 1);
+      *(size_t *)((char *)pvNext - UNIT_SIZE) |= PREV_FREE_FLAG;
+      my_free(my_malloc(5000));
+      _exit(0);
+   }
+
+   my_free(pvInUse);
+   my_free(pvNext);
+   if (iPid < 0 || waitpid(iPid, &iStatus, 0) != iPid)
+      return -1;
+   return WIFSIGNALED(iStatus) && WTERMSIG(iStatus) == SIGABRT;
+}
+
+void checkCheckLevels()
+
+/* A corrupted chunk that no call touches goes unnoticed by the cheap checks but not by
+   the full ones, periodic or on every call. Periodic checking must pass on a valid heap. */
+
+{
+   void *apvRegions[64];
+   int i;
+
+   CHECK(abortsOnCorruption(HEAPMGR_CHECK_CHEAP) == 0);
+   CHECK(abortsOnCorruption(HEAPMGR_CHECK_PERIODIC) == 1);
+   CHECK(abortsOnCorruption(HEAPMGR_CHECK_FULL) == 1);
+
+   HeapMgr_setCheckLevel(HEAPMGR_CHECK_PERIODIC, 3);
+   for (i = 0; i < 64; i++)
+      apvRegions[i] = my_malloc((size_t)(i + 1) * 100);
+   for (i = 0; i < 64; i += 2)
+      my_free(apvRegions[i]);
+   for (i = 1; i < 64; i += 2)
+      my_free(apvRegions[i]);
+   HeapMgr_setCheckLevel(HEAPMGR_CHECK_FULL, 0);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Threads of the thread cache check, and live regions and calls of each */
+#define CACHE_THREADS  4
+#define CACHE_SLOTS    64
+#define CACHE_CALLS    20000
+
+static void *cacheWorker(void *arg)
+
+/* Allocate and free CACHE_CALLS regions of up to 2 KB, keeping up to CACHE_SLOTS alive,
+   and check that each region keeps its contents. Return NULL if they all did. */
+
+{
+   unsigned char *apucSlots[CACHE_SLOTS] = {NULL};
+   size_t auiSizes[CACHE_SLOTS];
+   unsigned int uiSeed = (unsigned int)(size_t)arg;
+   unsigned char ucMark = (unsigned char)(size_t)arg;
+   void *pvResult = NULL;
+   size_t j;
+   int i, iSlot;
+
+   for (i = 0; i < CACHE_CALLS; i++) {
+      iSlot = rand_r(&uiSeed) % CACHE_SLOTS;
+      if (apucSlots[iSlot] != NULL) {
+         for (j = 0; j < auiSizes[iSlot]; j++)
+            if (apucSlots[iSlot][j] != ucMark)
+               pvResult = arg;
+         my_free(apucSlots[iSlot]);
+         apucSlots[iSlot] = NULL;
+      }
+      else {
+         auiSizes[iSlot] = (size_t)(rand_r(&uiSeed) % 2048) + 1;
+         apucSlots[iSlot] = (unsigned char *)my_malloc(auiSizes[iSlot]);
+         memset(apucSlots[iSlot], ucMark, auiSizes[iSlot]);
+      }
+   }
+
+   for (iSlot = 0; iSlot < CACHE_SLOTS; iSlot++)
+      my_free(apucSlots[iSlot]);
+   return pvResult;
+}
+
+void checkThreadCache()
+
+/* A freed chunk stays in use in this thread's cache and is handed back by the next
+   request of its size. Threads of several arenas must not corrupt each other's regions. */
+
+{
+   struct HeapMgrStats sBefore, sAfter;
+   pthread_t aThreads[CACHE_THREADS];
+   void *pvRegion, *pvResult;
+   int i;
+
+   pvRegion = my_malloc(600);
+   my_heap_stats(&sBefore);
+   my_free(pvRegion);
+   my_heap_stats(&sAfter);
+   CHECK(sAfter.uiFreeBytes == sBefore.uiFreeBytes);
+   CHECK(my_malloc(600) == pvRegion);
+   my_free(pvRegion);
+
+   HeapMgr_setArenaCount(CACHE_THREADS);
+   for (i = 0; i < CACHE_THREADS; i++)
+      pthread_create(&aThreads[i], NULL, cacheWorker, (void *)(size_t)(i + 1));
+   for (i = 0; i < CACHE_THREADS; i++) {
+      pthread_join(aThreads[i], &pvResult);
+      CHECK(pvResult == NULL);
+   }
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Chunks each thread of the remote free check allocates */
+#define REMOTE_CHUNKS  100
+#define REMOTE_SIZE    5000
+
+static void *remoteWorker(void *arg)
+
+/* Allocate REMOTE_CHUNKS chunks into the array arg and exit, leaving them to free. */
+
+{
+   void **apvChunks = (void **)arg;
+   int i;
+
+   for (i = 0; i < REMOTE_CHUNKS; i++)
+      apvChunks[i] = my_malloc(REMOTE_SIZE);
+   return NULL;
+}
+
+void checkRemoteFrees()
+
+/* Two threads, of two arenas one of which is not this thread's, allocate chunks and exit.
+   Freeing the chunks here must give them back to their heaps even though the threads
+   of their arenas are gone. */
+
+{
+   static void *apvChunks[2][REMOTE_CHUNKS];
+   struct HeapMgrStats sBefore, sAfter;
+   pthread_t thread;
+   int i, j;
+
+   HeapMgr_setArenaCount(2);
+   for (i = 0; i < 2; i++) {
+      pthread_create(&thread, NULL, remoteWorker, apvChunks[i]);
+      pthread_join(thread, NULL);
+   }
+
+   my_heap_stats(&sBefore);
+   for (i = 0; i < 2; i++)
+      for (j = 0; j < REMOTE_CHUNKS; j++)
+         my_free(apvChunks[i][j]);
+   my_heap_stats(&sAfter);
+
+   CHECK(sAfter.uiHeapBytes - sAfter.uiFreeBytes + 2 * REMOTE_CHUNKS * REMOTE_SIZE
+      <= sBefore.uiHeapBytes - sBefore.uiFreeBytes);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkMappedChunks()
+
+/* Requests from the mapping threshold up get their own mapping, out of the heaps, which
+   a resize keeps the contents of and a free unmaps. */
+
+{
+   struct HeapMgrStats sBefore, sMapped, sAfter;
+   unsigned char *pucRegion;
+   size_t i;
+   int iOk = TRUE;
+
+   my_heap_stats(&sBefore);
+   pucRegion = (unsigned char *)my_malloc(HEAPMGR_MMAP_THRESHOLD);
+   my_heap_stats(&sMapped);
+   CHECK(sMapped.uiMappedBytes >= sBefore.uiMappedBytes + HEAPMGR_MMAP_THRESHOLD);
+   CHECK(sMapped.uiHeapBytes == sBefore.uiHeapBytes);
+
+   for (i = 0; i < HEAPMGR_MMAP_THRESHOLD; i++)
+      pucRegion[i] = (unsigned char)(i % 251);
+   pucRegion = (unsigned char *)my_realloc(pucRegion, 4 * HEAPMGR_MMAP_THRESHOLD);
+   for (i = 0; i < HEAPMGR_MMAP_THRESHOLD; i++)
+      if (pucRegion[i] != (unsigned char)(i % 251))
+         iOk = FALSE;
+   CHECK(iOk);
+   my_free(pucRegion);
+   my_heap_stats(&sAfter);
+   CHECK(sAfter.uiMappedBytes == sBefore.uiMappedBytes);
+
+   HeapMgr_setMmapThreshold(32768);
+   pucRegion = (unsigned char *)my_malloc(40000);
+   my_heap_stats(&sMapped);
+   CHECK(sMapped.uiMappedBytes >= sBefore.uiMappedBytes + 40000);
+   my_free(pucRegion);
+   HeapMgr_setMmapThreshold(HEAPMGR_MMAP_THRESHOLD);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Chunks the trim check allocates at the top of the heap */
+#define TRIM_CHUNKS    64
+#define TRIM_SIZE      8000
+
+void checkTrim()
+
+/* Freeing the top of a heap past the trim threshold shrinks it, and so does
+   my_heap_trim() below the threshold, also discarding the pages of a free chunk inside
+   the heap. The memory given back must be usable again. */
+
+{
+   static void *apvChunks[TRIM_CHUNKS];
+   struct HeapMgrStats sBefore, sAfter;
+   void *pvInside, *pvGuard;
+   int i;
+
+   for (i = 0; i < TRIM_CHUNKS; i++)
+      apvChunks[i] = my_malloc(TRIM_SIZE);
+   my_heap_stats(&sBefore);
+   for (i = TRIM_CHUNKS - 1; i >= 0; i--)
+      my_free(apvChunks[i]);
+   my_heap_stats(&sAfter);
+   CHECK(sAfter.ulHeapTrims > sBefore.ulHeapTrims);
+   CHECK(sAfter.uiHeapBytes < sBefore.uiHeapBytes);
+
+   HeapMgr_setTrimThreshold((size_t)1 << 30);
+   for (i = 0; i < TRIM_CHUNKS; i++)
+      apvChunks[i] = my_malloc(TRIM_SIZE);
+   my_heap_stats(&sBefore);
+   for (i = TRIM_CHUNKS - 1; i >= 0; i--)
+      my_free(apvChunks[i]);
+   CHECK(my_heap_trim() > 0);
+   my_heap_stats(&sAfter);
+   CHECK(sAfter.uiHeapBytes < sBefore.uiHeapBytes);
+
+   pvInside = my_malloc(16 * 4096);
+   pvGuard = my_malloc(2000);
+   my_free(pvInside);
+   CHECK(my_heap_trim() >= 8 * 4096);
+   HeapMgr_setTrimThreshold(HEAPMGR_TRIM_THRESHOLD);
+
+   for (i = 0; i < TRIM_CHUNKS; i++) {
+      apvChunks[i] = my_malloc(TRIM_SIZE);
+      memset(apvChunks[i], 'x', TRIM_SIZE);
+   }
+   CHECK(HeapMgr_isValid());
+   for (i = 0; i < TRIM_CHUNKS; i++)
+      my_free(apvChunks[i]);
+   my_free(pvGuard);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkReallocInPlace()
+
+/* A region followed by a free chunk grows into it without moving, and shrinks in place,
+   keeping its contents. */
+
+{
+   char *pcRegion, *pcResized;
+   void *pvNext, *pvGuard;
+   int i, iOk = TRUE;
+
+   pcRegion = (char *)my_malloc(2000);
+   pvNext = my_malloc(4000);
+   pvGuard = my_malloc(2000);
+   for (i = 0; i < 2000; i++)
+      pcRegion[i] = (char)(i % 127);
+   my_free(pvNext);
+
+   pcResized = (char *)my_realloc(pcRegion, 5000);
+   CHECK(pcResized == pcRegion);
+   pcResized = (char *)my_realloc(pcRegion, 1000);
+   CHECK(pcResized == pcRegion);
+   for (i = 0; i < 1000; i++)
+      if (pcRegion[i] != (char)(i % 127))
+         iOk = FALSE;
+   CHECK(iOk);
+
+   my_free(pcRegion);
+   my_free(pvGuard);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+static int isZeroed(const void *pvRegion, size_t uiSize)
+
+/* Return TRUE if the uiSize bytes at pvRegion are all zero. */
+
+{
+   const unsigned char *pucByte = (const unsigned char *)pvRegion;
+   size_t i;
+
+   for (i = 0; i < uiSize; i++)
+      if (pucByte[i] != 0)
+         return FALSE;
+   return TRUE;
+}
+
+void checkCalloc()
+
+/* my_calloc skips clearing memory that is known to be zero, fresh from the operating
+   system, but must clear reused memory. The heap check verifies the chunks flagged as
+   zeroed. An overflowing size must fail. */
+
+{
+   static const size_t auiSizes[] = {24, 600, 3000, 40000, 2 * HEAPMGR_MMAP_THRESHOLD};
+   void *pvRegion;
+   size_t i;
+
+   for (i = 0; i < sizeof(auiSizes) / sizeof(auiSizes[0]); i++) {
+      pvRegion = my_malloc(auiSizes[i]);
+      memset(pvRegion, 0xAB, auiSizes[i]);
+      my_free(pvRegion);
+      pvRegion = my_calloc(1, auiSizes[i]);
+      CHECK(isZeroed(pvRegion, auiSizes[i]));
+      my_free(pvRegion);
+
+      pvRegion = my_calloc(auiSizes[i], 3);
+      CHECK(isZeroed(pvRegion, 3 * auiSizes[i]));
+      my_free(pvRegion);
+   }
+
+   CHECK(my_calloc((size_t)1 << (sizeof(size_t) * 4), (size_t)1 << (sizeof(size_t) * 4)) == NULL);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Slots the slab check frees from another thread */
+#define SLAB_SLOTS     1000
+
+static void *slabWorker(void *arg)
+
+/* Allocate SLAB_SLOTS slots of various classes into the array arg. */
+
+{
+   void **apvSlots = (void **)arg;
+   int i;
+
+   for (i = 0; i < SLAB_SLOTS; i++)
+      apvSlots[i] = my_malloc((size_t)(i % 256) + 1);
+   return NULL;
+}
+
+void checkSlabs()
+
+/* Small requests are served from slabs, outside the heaps, with slots of exactly their
+   class's size. Slots freed by size, or by another thread than the one that took them,
+   go back to their slabs. */
+
+{
+   static void *apvSlots[256], *apvRemote[SLAB_SLOTS];
+   struct HeapMgrStats sBefore, sAfter;
+   pthread_t thread;
+   size_t uiSize;
+   int i;
+
+   my_heap_stats(&sBefore);
+   for (uiSize = 1; uiSize <= 256; uiSize++) {
+      apvSlots[uiSize - 1] = my_malloc(uiSize);
+      CHECK((size_t)apvSlots[uiSize - 1] % UNIT_SIZE == 0);
+      CHECK(my_malloc_usable_size(apvSlots[uiSize - 1]) == (uiSize - 1) / UNIT_SIZE * UNIT_SIZE + UNIT_SIZE);
+      memset(apvSlots[uiSize - 1], 's', uiSize);
+   }
+   my_heap_stats(&sAfter);
+   CHECK(sAfter.uiSlabBytes > 0);
+   CHECK(sAfter.uiHeapBytes == sBefore.uiHeapBytes);
+   for (uiSize = 1; uiSize <= 256; uiSize++)
+      my_free_sized(apvSlots[uiSize - 1], uiSize);
+
+   pthread_create(&thread, NULL, slabWorker, apvRemote);
+   pthread_join(thread, NULL);
+   for (i = 0; i < SLAB_SLOTS; i++)
+      my_free(apvRemote[i]);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkFooters()
+
+/* An in use chunk has no footer : a request of whole units gets exactly that many usable
+   bytes, all of which may be written while the chunks around it are freed, and the
+   chunks still coalesce. */
+
+{
+   void *pvBefore, *pvAfter, *pvGuard;
+   char *pcRegion;
+
+   pvBefore = my_malloc(2000);
+   pcRegion = (char *)my_malloc(2000);
+   pvAfter = my_malloc(2000);
+   pvGuard = my_malloc(2000);
+   CHECK(my_malloc_usable_size(pcRegion) == 2000);
+
+   memset(pcRegion, 'f', 2000);
+   my_free(pvBefore);
+   memset(pcRegion, 'g', 2000);
+   my_free(pvAfter);
+   CHECK(HeapMgr_isValid());
+   memset(pcRegion, 'h', 2000);
+   my_free(pcRegion);
+
+   /* The three chunks coalesced into one, which takes a request of their total size */
+   pcRegion = (char *)my_malloc(3 * 2000 + 2 * UNIT_SIZE);
+   CHECK(pcRegion == (char *)pvBefore);
+   my_free(pcRegion);
+   my_free(pvGuard);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkAlignment()
+
+/* Every power of two up to 1 MB aligns regions of sizes from a slot to a mapping,
+   through each of the three aligned allocation functions. Invalid alignments fail. */
+
+{
+   static const size_t auiSizes[] = {1, 100, 3000, 40000, 2 * HEAPMGR_MMAP_THRESHOLD};
+   size_t uiAlign, i;
+   void *pvRegion, *pvUnchanged = &pvRegion;
+
+   for (uiAlign = 1; uiAlign <= ((size_t)1 << 20); uiAlign *= 2) {
+      for (i = 0; i < sizeof(auiSizes) / sizeof(auiSizes[0]); i++) {
+         pvRegion = my_memalign(uiAlign, auiSizes[i]);
+         CHECK(pvRegion != NULL && (size_t)pvRegion % uiAlign == 0);
+         memset(pvRegion, 'a', auiSizes[i]);
+         my_free(pvRegion);
+
+         pvRegion = my_aligned_alloc(uiAlign, auiSizes[i]);
+         CHECK(pvRegion != NULL && (size_t)pvRegion % uiAlign == 0);
+         memset(pvRegion, 'a', auiSizes[i]);
+         my_free(pvRegion);
+
+         if (uiAlign >= sizeof(void *)) {
+            CHECK(my_posix_memalign(&pvRegion, uiAlign, auiSizes[i]) == 0);
+            CHECK((size_t)pvRegion % uiAlign == 0);
+            memset(pvRegion, 'a', auiSizes[i]);
+            my_free(pvRegion);
+         }
+      }
+   }
+
+   CHECK(my_memalign(48, 100) == NULL);
+   pvRegion = pvUnchanged;
+   CHECK(my_posix_memalign(&pvRegion, 48, 100) == EINVAL);
+   CHECK(my_posix_memalign(&pvRegion, sizeof(void *) / 2, 100) == EINVAL);
+   CHECK(pvRegion == pvUnchanged);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkUsableSize()
+
+/* Every region has at least the bytes asked for usable, all of which may be written, and
+   my_malloc_ex reports the same number. */
+
+{
+   size_t uiSize, uiActual, uiUsable;
+   void *pvRegion;
+
+   CHECK(my_malloc_usable_size(NULL) == 0);
+   for (uiSize = 1; uiSize <= 2 * HEAPMGR_MMAP_THRESHOLD; uiSize += uiSize / 8 + 1) {
+      pvRegion = my_malloc_ex(uiSize, &uiActual);
+      uiUsable = my_malloc_usable_size(pvRegion);
+      CHECK(uiUsable >= uiSize);
+      CHECK(uiActual == uiUsable);
+      memset(pvRegion, 'u', uiUsable);
+      my_free(pvRegion);
+   }
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkStatistics()
+
+/* The call counters and in use bytes follow the calls made, and the free chunks counted
+   per bin agree with a walk of the heaps. */
+
+{
+   static const size_t auiSizes[] = {24, 600, 3000, 40000, 2 * HEAPMGR_MMAP_THRESHOLD};
+   void *apvRegions[sizeof(auiSizes) / sizeof(auiSizes[0])];
+   struct HeapMgrStats sBefore, sAfter;
+   struct HeapMgrFragmentation sFrag;
+   size_t i, uiUsable = 0, uiChunks = 0;
+
+   my_heap_stats(&sBefore);
+   for (i = 0; i < sizeof(auiSizes) / sizeof(auiSizes[0]); i++) {
+      apvRegions[i] = my_malloc(auiSizes[i]);
+      uiUsable += my_malloc_usable_size(apvRegions[i]);
+   }
+   apvRegions[0] = my_realloc(apvRegions[0], 32);
+   my_heap_stats(&sAfter);
+   CHECK(sAfter.ulMallocs == sBefore.ulMallocs + i);
+   CHECK(sAfter.ulReallocs == sBefore.ulReallocs + 1);
+   CHECK(sAfter.uiInUseBytes == sBefore.uiInUseBytes + uiUsable);
+   CHECK(sAfter.uiMappedBytes >= sBefore.uiMappedBytes + 2 * HEAPMGR_MMAP_THRESHOLD);
+
+   for (i = 0; i < sizeof(auiSizes) / sizeof(auiSizes[0]); i++)
+      my_free(apvRegions[i]);
+   my_heap_stats(&sAfter);
+   CHECK(sAfter.ulFrees == sBefore.ulFrees + i);
+   CHECK(sAfter.uiInUseBytes == sBefore.uiInUseBytes);
+
+   my_heap_fragmentation(&sFrag);
+   for (i = 0; i < HEAPMGR_NUM_BINS; i++)
+      uiChunks += sAfter.auiBinChunks[i];
+   CHECK(uiChunks == sFrag.uiFreeChunks);
+   CHECK(sAfter.uiFreeBytes == sFrag.uiFreeBytes);
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Regions the trace check allocates and frees while tracing */
+#define TRACE_REGIONS  100
+
+static size_t countTraceRecords(const char *pcPath)
+
+/* Return the number of records of the trace file pcPath, or 0 if it is not one. */
+
+{
+   struct HeapMgrTraceBlock sBlock;
+   char acMagic[sizeof(HEAPMGR_TRACE_MAGIC) - 1];
+   size_t uiRecords = 0;
+   FILE *psFile;
+
+   psFile = fopen(pcPath, "rb");
+   if (psFile == NULL)
+      return 0;
+   if (fread(acMagic, sizeof(acMagic), 1, psFile) == 1
+         && memcmp(acMagic, HEAPMGR_TRACE_MAGIC, sizeof(acMagic)) == 0) {
+      while (fread(&sBlock, sizeof(sBlock), 1, psFile) == 1) {
+         uiRecords += sBlock.uiCount;
+         if (fseek(psFile, (long)(sBlock.uiCount * sizeof(struct HeapMgrTraceRecord)), SEEK_CUR) != 0)
+            break;
+      }
+   }
+   fclose(psFile);
+   return uiRecords;
+}
+
+void checkTrace()
+
+/* Every call made while tracing is recorded, and the replay tool replays the trace. */
+
+{
+   void *apvRegions[TRACE_REGIONS];
+   char acPath[64], acCommand[128];
+   int i;
+
+   snprintf(acPath, sizeof(acPath), "/tmp/heapcheck-%d.trace", (int)getpid());
+   CHECK(HeapMgr_startTrace(acPath) == 0);
+   for (i = 0; i < TRACE_REGIONS; i++)
+      apvRegions[i] = my_malloc((size_t)(i + 1) * 50);
+   apvRegions[0] = my_realloc(apvRegions[0], 5000);
+   for (i = 0; i < TRACE_REGIONS; i++)
+      my_free(apvRegions[i]);
+   HeapMgr_stopTrace();
+
+   CHECK(countTraceRecords(acPath) == 2 * TRACE_REGIONS + 1);
+   snprintf(acCommand, sizeof(acCommand), "./replay %s > /dev/null", acPath);
+   CHECK(system(acCommand) == 0);
+   remove(acPath);
+}
+
+/*--------------------------------------------------------------------*/
+
+void checkPreload()
+
+/* A program run with the preload library allocates through the heap manager, as its
+   trace shows, and works. */
+
+{
+   char acLibrary[4096], acPath[64], acCommand[4352];
+
+   CHECK(realpath("libheapmngr.so", acLibrary) != NULL);
+   snprintf(acPath, sizeof(acPath), "/tmp/heapcheck-%d.preload.trace", (int)getpid());
+   snprintf(acCommand, sizeof(acCommand),
+      "LD_PRELOAD=%s HEAPMGR_TRACE=%s ls -lR /usr/include > /dev/null", acLibrary, acPath);
+   CHECK(system(acCommand) == 0);
+   CHECK(countTraceRecords(acPath) > 0);
+   remove(acPath);
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Bytes of the regions of the heaps the handle check creates */
+#define HANDLE_REGION  ((size_t)256 << 10)
+
+static size_t fillHeap(HeapMgr_T oHeap, void **apvRegions, size_t uiMax, size_t uiSize)
+
+/* Allocate regions of uiSize bytes from oHeap into apvRegions until it runs out, at most
+   uiMax of them, and return how many it allocated. */
+
+{
+   size_t uiCount;
+
+   for (uiCount = 0; uiCount < uiMax; uiCount++) {
+      apvRegions[uiCount] = HeapMgr_malloc(oHeap, uiSize);
+      if (apvRegions[uiCount] == NULL)
+         break;
+      memset(apvRegions[uiCount], (int)uiCount, uiSize);
+   }
+   return uiCount;
+}
+
+void checkHandles()
+
+/* Two heaps made in the caller's memory allocate only from it and do not touch each
+   other. An exhausted heap fails requests, and takes them again once its regions are
+   freed, as one coalesced chunk. Destroying a heap leaves the other one alone. */
+
+{
+   static char acFirst[HANDLE_REGION], acSecond[HANDLE_REGION];
+   static void *apvFirst[HANDLE_REGION / 1000], *apvSecond[16];
+   HeapMgr_T oFirst, oSecond;
+   size_t uiCount, i, j;
+   int iOk = TRUE;
+
+   CHECK(HeapMgr_create(acFirst, 64) == NULL);
+   oFirst = HeapMgr_create(acFirst, HANDLE_REGION);
+   oSecond = HeapMgr_create(acSecond, HANDLE_REGION);
+   CHECK(oFirst != NULL && oSecond != NULL && oFirst != HeapMgr_default());
+
+   CHECK(fillHeap(oSecond, apvSecond, 16, 1000) == 16);
+   uiCount = fillHeap(oFirst, apvFirst, HANDLE_REGION / 1000, 1000);
+   CHECK(uiCount > HANDLE_REGION / 1000 / 2 && uiCount < HANDLE_REGION / 1000);
+   for (i = 0; i < uiCount; i++)
+      CHECK(isInside(apvFirst[i], acFirst, HANDLE_REGION));
+   for (i = 0; i < 16; i++)
+      CHECK(isInside(apvSecond[i], acSecond, HANDLE_REGION));
+
+   for (i = 0; i < uiCount; i++)
+      HeapMgr_free(oFirst, apvFirst[i]);
+   apvFirst[0] = HeapMgr_malloc(oFirst, uiCount * 1000);
+   CHECK(apvFirst[0] != NULL);
+   HeapMgr_free(oFirst, apvFirst[0]);
+   CHECK(fillHeap(oFirst, apvFirst, HANDLE_REGION / 1000, 1000) == uiCount);
+   HeapMgr_destroy(oFirst);
+
+   for (i = 0; i < 16; i++)
+      for (j = 0; j < 1000; j++)
+         if (((unsigned char *)apvSecond[i])[j] != (unsigned char)i)
+            iOk = FALSE;
+   CHECK(iOk);
+   for (i = 0; i < 16; i++)
+      HeapMgr_free(oSecond, apvSecond[i]);
+   HeapMgr_destroy(oSecond);
+
+   apvFirst[0] = HeapMgr_malloc(HeapMgr_default(), 1000);
+   CHECK(apvFirst[0] != NULL);
+   HeapMgr_free(HeapMgr_default(), apvFirst[0]);
+   CHECK(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
+typedef struct Check {
+   const char *pcName;
+   void (*pfCheck)(void);
+} Check;
+
+static const Check asChecks[] = {
+   {"bin bitmap", checkBinBitmap},
+   {"large bin tree", checkLargeBinTree},
+   {"lifo bins", checkLifoBins},
+   {"check levels", checkCheckLevels},
+   {"thread cache", checkThreadCache},
+   {"remote frees", checkRemoteFrees},
+   {"mapped chunks", checkMappedChunks},
+   {"trim", checkTrim},
+   {"realloc in place", checkReallocInPlace},
+   {"calloc", checkCalloc},
+   {"slabs", checkSlabs},
+   {"footers", checkFooters},
+   {"alignment", checkAlignment},
+   {"usable size", checkUsableSize},
+   {"statistics", checkStatistics},
+   {"trace and replay", checkTrace},
+   {"preload", checkPreload},
+   {"handles", checkHandles},
+};
+
+int main(void)
+
+/* Run every check at the full check level and report the failures. */
+
+{
+   size_t i;
+   int iBefore;
+
+   HeapMgr_setCheckLevel(HEAPMGR_CHECK_FULL, 0);
+
+   for (i = 0; i < sizeof(asChecks) / sizeof(asChecks[0]); i++) {
+      iBefore = iFailures;
+      asChecks[i].pfCheck();
+      printf("%-24s %s\n", asChecks[i].pcName, iFailures == iBefore ? "ok" : "FAILED");
+   }
+
+   return iFailures != 0;
+}
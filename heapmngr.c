@@ -15,33 +15,354 @@
  *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 *****************************************************************************/
 
+#define _GNU_SOURCE		/* For mremap */
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "heapmngr.h"
 #include "chunk.h"
 #define MAX_SIZE			1024	/* Units */
-#define NUM_BINS			1024
+#define NUM_BINS			HEAPMGR_NUM_BINS
 #define MIN_UNITS_FROM_OS	1024
+#define BITMAP_WORD_BITS	64
+#define NUM_BITMAP_WORDS	(NUM_BINS / BITMAP_WORD_BITS)
+
+/* Default check level : cheap local checks in debug builds, nothing in release builds.
+	Override with -DHEAPMGR_CHECK_LEVEL=<level> -DHEAPMGR_CHECK_INTERVAL=<ops> */
+#ifndef HEAPMGR_CHECK_LEVEL
+#ifdef NDEBUG
+#define HEAPMGR_CHECK_LEVEL		HEAPMGR_CHECK_OFF
+#else
+#define HEAPMGR_CHECK_LEVEL		HEAPMGR_CHECK_CHEAP
+#endif
+#endif
+#ifndef HEAPMGR_CHECK_INTERVAL
+#define HEAPMGR_CHECK_INTERVAL	1024
+#endif
+
+/* Per-thread cache : chunks of up to TCACHE_MAX_UNITS units are cached per size, at most
+	TCACHE_MAX_COUNT of each, and taken from the bins TCACHE_FILL at a time */
+#ifndef TCACHE_MAX_UNITS
+#define TCACHE_MAX_UNITS	64
+#endif
+#ifndef TCACHE_MAX_COUNT
+#define TCACHE_MAX_COUNT	32
+#endif
+#ifndef TCACHE_FILL
+#define TCACHE_FILL			8
+#endif
+
+/* Arenas : at most HEAPMGR_MAX_ARENAS (see heapmngr.h), the default count being the number
+	of online processors. Each arena but the main one reserves HEAPMGR_ARENA_SIZE bytes
+	(a power of two) of address space, backed only as its heap grows */
+#ifndef HEAPMGR_ARENA_SIZE
+#define HEAPMGR_ARENA_SIZE	((size_t)256 << 20)
+#endif
+
+/* my_free gives the top of a heap back once the last free chunk reaches
+	HEAPMGR_TRIM_THRESHOLD bytes (see heapmngr.h), keeping MAX_SIZE units at the top */
+
+/* Requests of at most HEAPMGR_SLAB_MAX_SIZE bytes are served from slabs : SLAB_SIZE
+	aligned pages of equal slots, with no boundary tags, carved from one reserved
+	region of HEAPMGR_SLAB_REGION_SIZE bytes */
+#ifndef HEAPMGR_SLAB_MAX_SIZE
+#define HEAPMGR_SLAB_MAX_SIZE	256
+#endif
+#ifndef HEAPMGR_SLAB_REGION_SIZE
+#define HEAPMGR_SLAB_REGION_SIZE	((size_t)256 << 20)
+#endif
+#define SLAB_SIZE			4096
+#define SLAB_ALIGN			16		/* Bytes, the alignment of every region */
+#define NUM_SLAB_CLASSES	(HEAPMGR_SLAB_MAX_SIZE / SLAB_ALIGN)
+#define MAX_SLABS			(HEAPMGR_SLAB_REGION_SIZE / SLAB_SIZE)
+
+/* The number of slabs at the start of the slab region taken by the stack of free slab indices */
+#define INDEX_SLABS			((MAX_SLABS * sizeof(uint32_t) - 1) / SLAB_SIZE + 1)
+
+/* Each tracing thread buffers TRACE_RING_RECORDS records before writing them out */
+#ifndef TRACE_RING_RECORDS
+#define TRACE_RING_RECORDS	2048
+#endif
+
+/* The checks are assertions, so they cost nothing when compiled with NDEBUG */
+#define CHECK_HEAP()	assert(checkHeap(arena))
+#define CHECK_CHUNK(c)	assert(__atomic_load_n(&checkLevel, __ATOMIC_RELAXED) < HEAPMGR_CHECK_CHEAP || Chunk_isValid(c, arena->HeapStart, arena->HeapEnd))
+#define CHECK_SLABS()	assert(__atomic_load_n(&checkLevel, __ATOMIC_RELAXED) < HEAPMGR_CHECK_FULL || SlabsareValid(arena))
+
+/* Tracing costs a single test of traceOn while it is off */
+#define TRACE(op, id, aux, size)	do { if (__atomic_load_n(&traceOn, __ATOMIC_RELAXED)) \
+	traceEvent(op, (uintptr_t)(id), aux, size); } while (0)
 
 /* INITIALLY ....................................................................*/
 
-static Chunk_T HeapStart = NULL;
-/* Starting address pointer of avalilable memory set to NULL */
+typedef struct HeapMgr *Arena_T;
+typedef struct Slab *Slab_T;
 
-static Chunk_T HeapEnd = NULL;
-/* Ending address pointer of avaliable memory set to NULL */
+typedef struct HeapMgr {
+	pthread_mutex_t lock;
+	/* Lock protecting the arena's heap and bins. my_malloc and my_free only take it
+		when the thread's cache cannot serve them */
 
-static Chunk_T freebinArray[NUM_BINS];
-/* Array of bins to doubly linked NUL terminated free lists of different bin sizes */
+	Chunk_T HeapStart;
+	/* Starting address pointer of avalilable memory set to NULL */
+
+	Chunk_T HeapEnd;
+	/* Ending address pointer of avaliable memory set to NULL */
+
+	Chunk_T RegionEnd;
+	/* End of the region reserved for the heap, or NULL if the heap grows with brk */
+
+	int External;
+	/* Whether the region is the caller's, given to HeapMgr_create : it is not known to be
+		zero filled and its pages are never given back */
+
+	int LastFree;
+	/* Whether the last chunk of the heap is free : the prev free bit of the chunk that
+		would start at HeapEnd */
+
+	Chunk_T freebinArray[NUM_BINS];
+	/* Array of bins to doubly linked NUL terminated free lists of different bin sizes.
+		The last bin, holding every chunk of NUM_BINS - 1 units or more, is instead the root
+		of a red-black tree keyed by size. Each tree node heads the free list of the other
+		chunks of its size, so a node is recognised by its NULL prev in list */
+
+	uint64_t binBitmap[NUM_BITMAP_WORDS];
+	/* Occupancy bitmap of freebinArray : bit i of word w is set iff bin (w * 64 + i) is non empty */
+
+	uint64_t binSummary;
+	/* Second level of the bitmap : bit w is set iff binBitmap[w] is non zero */
+
+	Chunk_T remoteFrees;
+	/* Lock-free stack, linked by next in list, of in use chunks freed by threads of other
+		arenas. Any thread pushes with a compare and swap, the lock holder takes the
+		whole stack at once, so it is never popped one chunk at a time and has no ABA */
+
+	Slab_T slabClasses[NUM_SLAB_CLASSES];
+	/* Doubly linked NULL terminated lists of the arena's slabs that have free slots, one
+		per slot size */
+
+	void *remoteSlots;
+	/* Lock-free stack, linked by their first word, of slots of the arena's slabs freed
+		by threads of other arenas. Used like remoteFrees */
+
+	size_t binChunks[NUM_BINS];
+	/* The number of free chunks in each bin */
+
+	size_t freeUnits;
+	/* The number of units of all the free chunks in the bins */
+
+	unsigned long growths, trims, splits, coalesces;
+	/* How many times the heap grew and shrank, a free chunk was split to serve a request
+		and two free chunks were coalesced */
+} Arena;
+/* An arena is an independent heap with its own bins and lock. The main arena is the
+	brk heap; every other arena lives at the start of its own HEAPMGR_ARENA_SIZE aligned
+	region, so the arena owning a chunk is found by rounding the chunk's address down.
+	A HeapMgr_T made by HeapMgr_create is an arena at the start of the caller's region,
+	outside of arenaList : only its handle finds it */
+
+typedef struct Slab {
+	Arena_T arena;
+	/* The arena whose lock protects the slab */
+
+	Slab_T next;
+	Slab_T prev;
+	/* Links in the arena's list of slabs of this slot size that have free slots */
+
+	void *freeSlots;
+	/* NULL terminated list, linked by their first word, of the free slots */
+
+	unsigned int slotSize;
+	/* The size in bytes of every slot */
+
+	unsigned int used;
+	/* The number of slots handed out, including those sitting in a thread's cache */
+} Slab;
+/* A slab is a SLAB_SIZE page of the slab region, this header followed by equal slots.
+	The slab of a slot is found by rounding the slot's address down */
+
+#define SLAB_HEADER_SIZE	((sizeof(struct Slab) - 1) / SLAB_ALIGN * SLAB_ALIGN + SLAB_ALIGN)
+
+static Arena mainArena = {PTHREAD_MUTEX_INITIALIZER};
+/* The arena of the brk heap */
+
+static Arena_T arenaList[HEAPMGR_MAX_ARENAS] = {&mainArena};
+/* Arenas created so far, in creation order */
+
+static unsigned int createdArenas = 1;
+/* The number of arenas in arenaList */
+
+static unsigned int numArenas = 0;
+/* The number of arenas threads are spread over, 0 until first use */
+
+static unsigned int nextArena = 0;
+/* Round robin counter assigning arenas to new threads */
+
+static pthread_mutex_t arenaListLock = PTHREAD_MUTEX_INITIALIZER;
+/* Lock serializing the creation of arenas */
+
+static __thread Arena_T threadArena;
+/* The arena this thread allocates from, NULL until its first allocation */
+
+typedef struct TraceRing {
+	unsigned int head;
+	/* The number of records ever written, only by the owning thread */
+
+	unsigned int tail;
+	/* The number of records ever written out, only by the holder of traceLock */
+
+	uint32_t thread;
+	/* The number identifying the owning thread in the trace */
+
+	struct TraceRing *next, *prev;
+	/* Links in traceRings */
+
+	struct HeapMgrTraceRecord records[TRACE_RING_RECORDS];
+} TraceRing;
+/* A thread's trace buffer, mapped when the thread first traces. The thread fills it and
+	whoever holds traceLock empties it into the trace file, so the thread never waits
+	unless it is full */
+
+typedef struct ThreadStats {
+	size_t mallocs, frees, reallocs;
+	/* The number of successful calls, my_calloc, my_memalign and each region of
+		my_malloc_batch counting as allocations */
+
+	size_t allocated, freed;
+	/* The usable bytes of the regions allocated and freed */
+
+	size_t requested;
+	/* The bytes asked for by the allocations counted in allocated */
+
+	struct ThreadStats *next, *prev;
+	/* Links in threadStatsList */
+} ThreadStats;
+/* A thread's statistics. Only the thread writes them, with relaxed atomic stores, so that
+	my_heap_stats can read them at any time without slowing the thread down */
+
+typedef struct TCache {
+	Chunk_T bins[TCACHE_MAX_UNITS + 1];
+	/* NULL terminated lists, linked by next in list, of cached in use chunks of each size */
+
+	unsigned int count[TCACHE_MAX_UNITS + 1];
+	/* The number of chunks in each list */
+
+	void *slots[NUM_SLAB_CLASSES];
+	/* NULL terminated lists, linked by their first word, of cached slots of each slot size */
+
+	unsigned int slotCount[NUM_SLAB_CLASSES];
+	/* The number of slots in each list */
+
+	int registered;
+	/* Whether the cache is flushed when the thread exits */
+
+	ThreadStats stats;
+	/* This thread's statistics, in threadStatsList while the cache is registered */
+
+	TraceRing *traceRing;
+	/* This thread's trace buffer, NULL until it first traces */
+} TCache;
+
+static __thread TCache tcache;
+/* This thread's cache of recently freed small chunks, which may belong to any arena */
+
+static pthread_key_t tcacheKey;
+static pthread_once_t tcacheKeyOnce = PTHREAD_ONCE_INIT;
+/* Key whose destructor flushes the cache of an exiting thread */
+
+static char *slabRegion;
+/* The region slabs are carved from, NULL until the first slab or if it cannot be mapped */
+
+static uint32_t *freeSlabs;
+/* Stack of the indices of the empty slabs given back, at the start of the slab region */
+
+static unsigned int slabCount;
+/* The number of slab sized pages of the slab region in use, freeSlabs included */
+
+static unsigned int freeSlabCount;
+static unsigned int cleanSlabCount;
+/* The number of entries of freeSlabs, and how many at its bottom have been discarded */
+
+static pthread_mutex_t slabLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t slabRegionOnce = PTHREAD_ONCE_INIT;
+/* Lock protecting the slab region's counters and freeSlabs */
+
+static ThreadStats *threadStatsList;
+static ThreadStats exitedStats;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+/* The statistics of the registered threads, those of the threads that exited summed up,
+	and the lock protecting both */
+
+static int traceOn;
+/* Whether the allocation functions are being traced */
+
+static int traceFd = -1;
+static uint64_t traceStart;
+/* The trace file, -1 when not tracing, and the time the trace started */
+
+static TraceRing *traceRings;
+static uint32_t traceThreads;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+/* The trace buffers of all threads, the number of them ever mapped, and the lock
+	protecting them and the trace file */
+
+static size_t mappedBytes;
+/* The number of bytes of all direct mappings */
+
+static size_t mmapThreshold = HEAPMGR_MMAP_THRESHOLD;
+/* Size from which requests bypass the arenas and are mapped directly */
+
+static size_t trimThreshold = HEAPMGR_TRIM_THRESHOLD;
+/* Size of the free chunk at the top of a heap from which my_free shrinks the heap */
+
+static enum HeapMgrCheckLevel checkLevel = HEAPMGR_CHECK_LEVEL;
+/* How much consistency checking my_malloc and my_free do */
+
+static unsigned long checkInterval = HEAPMGR_CHECK_INTERVAL;
+static unsigned long checkCount = 0;
+/* With HEAPMGR_CHECK_PERIODIC, the whole heap is checked on every checkInterval-th check */
 
 /* ................................................................................ */
 
+int FindBin(size_t Units)
+
+/* Returns correct bin size */
+
+{
+	if (Units > (NUM_BINS - 1))
+		return NUM_BINS - 1;
+	return (int)Units;
+}
+
 /* TESTING PURPOSES............................................................ */
 
-void PrintBin()
+void PrintTree(Chunk_T node)
+
+/* Prints the chunks of the large bin tree below node in increasing size */
+
+{
+	Chunk_T ptr;
+
+	if (node == NULL)
+		return;
+	PrintTree(Chunk_getChild(node, 0));
+	for (ptr = node; ptr != NULL; ptr = Chunk_getNextInList(ptr))
+		printf("i : %d, size : %d\n", NUM_BINS - 1, (int)Chunk_getUnits(ptr));
+	PrintTree(Chunk_getChild(node, 1));
+}
+
+void PrintBin(Arena_T arena)
 
 /* Prints entire link structure of all bins which are non empty */
 
@@ -49,36 +370,161 @@ void PrintBin()
 	int i;
 	Chunk_T ptr;
 
-	for (i = 0; i < NUM_BINS; i++) {
-		ptr = freebinArray[i];
+	for (i = 0; i < NUM_BINS - 1; i++) {
+		ptr = arena->freebinArray[i];
 		while (ptr != NULL) {
 			printf("i : %d, size : %d\n", i, (int)Chunk_getUnits(ptr));
 			ptr = Chunk_getNextInList(ptr);
 		}
 	}
+	PrintTree(arena->freebinArray[NUM_BINS - 1]);
 }
 
-void PrintMemory()
+void PrintMemory(Arena_T arena)
 
 /* Prints all chunks in physical memory from HeapStart to HeapEnd
    i.e. their size and status */
 
 {
-   Chunk_T ChunkPtr = HeapStart;
+   Chunk_T ChunkPtr = arena->HeapStart;
 
-  	while (ChunkPtr != HeapEnd && ChunkPtr != NULL) {
+  	while (ChunkPtr != arena->HeapEnd && ChunkPtr != NULL) {
    		if (Chunk_getStatus(ChunkPtr) == CHUNK_FREE)
       		printf("\tSTATUS : FREE  , ");
     	else
     		printf("\tSTATUS : IN USE, ");
 
     	printf("SIZE : %d Chunks\n", (int)Chunk_getUnits(ChunkPtr));
-    	ChunkPtr = Chunk_getNextInMem(ChunkPtr, HeapEnd);
+    	ChunkPtr = Chunk_getNextInMem(ChunkPtr, arena->HeapEnd);
     }
 }
 /*--------------------------------------------------------------------*/
 
-int HeapMgr_isValid()
+void reportError(const char *pcMessage, const char *pcName, int iValue)
+
+/* Writes pcMessage, followed by ", pcName = iValue" if pcName is not NULL, to the standard
+	error. Goes straight to write(2) rather than through stdio, which may allocate and so
+	call back into the heap manager when it replaces malloc */
+
+{
+	char line[160], digits[12];
+	size_t len = strlen(pcMessage), n = 0;
+	unsigned int value;
+
+	if (len > sizeof(line) - 48)
+		len = sizeof(line) - 48;
+	memcpy(line, pcMessage, len);
+	if (pcName != NULL && strlen(pcName) < 16) {
+		memcpy(line + len, ", ", 2);
+		memcpy(line + len + 2, pcName, strlen(pcName));
+		len += 2 + strlen(pcName);
+		memcpy(line + len, " = ", 3);
+		len += 3;
+		if (iValue < 0)
+			line[len++] = '-';
+		value = iValue < 0 ? 0u - (unsigned int)iValue : (unsigned int)iValue;
+		do {
+			digits[n++] = (char)('0' + value % 10);
+			value /= 10;
+		} while (value != 0);
+		while (n > 0)
+			line[len++] = digits[--n];
+	}
+	line[len++] = '\n';
+	(void)!write(STDERR_FILENO, line, len);
+}
+
+/*--------------------------------------------------------------------*/
+
+int ChunkinBin(Arena_T arena, Chunk_T chunk_ptr)
+
+/* Return 1 (TRUE) if the free chunk is linked in its bin, or 0 (FALSE) otherwise.
+	Large chunks are looked up in the tree by size, then in that node's list */
+
+{
+	Chunk_T ptr = arena->freebinArray[FindBin(Chunk_getUnits(chunk_ptr))];
+
+	if (FindBin(Chunk_getUnits(chunk_ptr)) == NUM_BINS - 1) {
+		while (ptr != NULL && Chunk_getUnits(ptr) != Chunk_getUnits(chunk_ptr))
+			ptr = Chunk_getChild(ptr, Chunk_getUnits(ptr) < Chunk_getUnits(chunk_ptr));
+	}
+
+	while (ptr != NULL && ptr != chunk_ptr)
+		ptr = Chunk_getNextInList(ptr);
+
+	return ptr != NULL;
+}
+
+int TreeisValid(Chunk_T node, Chunk_T parent, size_t min_units, size_t max_units)
+
+/* Checks the large bin subtree at node : parent links, sizes strictly within
+	(min_units, max_units), no red node with a red child, and equal black heights.
+	Returns the black height of the subtree, or -1 if it is not valid */
+
+{
+	Chunk_T ptr;
+	int left_height, right_height;
+
+	if (node == NULL)
+		return 0;
+
+	if (Chunk_getParent(node) != parent) {
+		reportError("Faulty parent link in large bin tree", NULL, 0); return -1;
+	}
+	if (Chunk_getUnits(node) <= min_units || Chunk_getUnits(node) >= max_units) {
+		reportError("Large bin tree out of order", NULL, 0); return -1;
+	}
+	if (Chunk_getColor(node) == CHUNK_RED && parent != NULL && Chunk_getColor(parent) == CHUNK_RED) {
+		reportError("Red node with red parent in large bin tree", NULL, 0); return -1;
+	}
+
+	/* Every chunk of the node's list has the node's size and is free */
+	for (ptr = node; ptr != NULL; ptr = Chunk_getNextInList(ptr)) {
+		if (Chunk_getUnits(ptr) != Chunk_getUnits(node) || Chunk_getStatus(ptr) != CHUNK_FREE) {
+			reportError("Bad chunk in large bin tree list", NULL, 0); return -1;
+		}
+	}
+
+	left_height = TreeisValid(Chunk_getChild(node, 0), node, min_units, Chunk_getUnits(node));
+	right_height = TreeisValid(Chunk_getChild(node, 1), node, Chunk_getUnits(node), max_units);
+	if (left_height == -1 || right_height == -1)
+		return -1;
+	if (left_height != right_height) {
+		reportError("Unbalanced large bin tree", NULL, 0); return -1;
+	}
+
+	return left_height + (Chunk_getColor(node) == CHUNK_BLACK);
+}
+
+/*--------------------------------------------------------------------*/
+
+int FreeCountsareValid(Arena_T arena)
+
+/* Return 1 (TRUE) if the arena's counts of free chunks and units match the free chunks
+	in its heap, or 0 (FALSE) otherwise */
+
+{
+	Chunk_T Chunk;
+	size_t chunks = 0, units = 0;
+	int iBin;
+
+	for (Chunk = arena->HeapStart; Chunk != NULL; Chunk = Chunk_getNextInMem(Chunk, arena->HeapEnd)) {
+		if (Chunk_getStatus(Chunk) == CHUNK_FREE) {
+			chunks++;
+			units += Chunk_getUnits(Chunk);
+		}
+	}
+	for (iBin = 0; iBin < NUM_BINS; iBin++)
+		chunks -= arena->binChunks[iBin];
+
+	if (chunks != 0 || units != arena->freeUnits) {
+		reportError("Free chunk counts out of date", NULL, 0);
+		return 0;
+	}
+	return 1;
+}
+
+int ArenaisValid(Arena_T arena)
 
 /* Return 1 (TRUE) if the heap manager is in a valid state, or
    0 (FALSE) otherwise. */
@@ -92,79 +538,119 @@ int HeapMgr_isValid()
 	int i = 0;
 
 	Chunk_T MemChunk;
-	Chunk_T ListChunk;
 
-	if (HeapStart == NULL) {
-		fprintf(stderr, "Uninitialized heap start\n"); return 0;
+	if (arena->HeapStart == NULL) {
+		reportError("Uninitialized heap start", NULL, 0); return 0;
 	}
-	if (HeapEnd == NULL) {
-		fprintf(stderr, "Uninitialized heap end\n"); return 0;
+	if (arena->HeapEnd == NULL) {
+		reportError("Uninitialized heap end", NULL, 0); return 0;
 	}
 
-	if (HeapStart == HeapEnd) {
+	if (arena->HeapStart == arena->HeapEnd) {
 		for (iBin = 0; iBin < NUM_BINS; iBin++) {
-			if (freebinArray[iBin] != NULL) {
-				fprintf(stderr, "Inconsistent empty heap\n");
+			if (arena->freebinArray[iBin] != NULL) {
+				reportError("Inconsistent empty heap", NULL, 0);
 				return 0;
 			}
 		}
 		return 1;
 	}
 
+	/* Check to make sure the occupancy bitmap agrees with the bins */
+	for (iBin = 0; iBin < NUM_BINS; iBin++) {
+		if (((arena->binBitmap[iBin / BITMAP_WORD_BITS] >> (iBin % BITMAP_WORD_BITS)) & 1) != (arena->freebinArray[iBin] != NULL)) {
+			reportError("Bin bitmap out of date", "Bin", iBin);
+			return 0;
+		}
+	}
+	for (iBin = 0; iBin < NUM_BITMAP_WORDS; iBin++) {
+		if (((arena->binSummary >> iBin) & 1) != (arena->binBitmap[iBin] != 0)) {
+			reportError("Bin summary out of date", "Word", iBin);
+			return 0;
+		}
+	}
+
 	/* Check to make sure the first MIN_UNITS_PER_CHUNK bins do not contain anything */
 	for (iBin = 0; iBin < MIN_UNITS_PER_CHUNK; iBin++) {
-		if (freebinArray[iBin] != NULL) {
-			fprintf(stderr, "Chunks placed in too small bins, Bin = %d\n", iBin);
+		if (arena->freebinArray[iBin] != NULL) {
+			reportError("Chunks placed in too small bins", "Bin", iBin);
 	        return 0;
 	    }
 	}
 
 	/* Check to make sure the first free Chunk in each bin has a null prev list chunk */
 	for (iBin = 0; iBin < NUM_BINS; iBin++) {
-		Chunk = freebinArray[iBin];
+		Chunk = arena->freebinArray[iBin];
 		if (Chunk != NULL) {
 			if (Chunk_getPrevInList(Chunk) != NULL) {
-        		fprintf(stderr, "First Free Chunk has Faulty backwards pointer, ""Bin = %d\n", iBin);
+        		reportError("First Free Chunk has Faulty backwards pointer", "Bin", iBin);
         		return 0;
         	}
         }
     }
 
+	/* Check to make sure the statistics agree with the free chunks in memory */
+	if (!FreeCountsareValid(arena))
+		return 0;
+
     /* Check if all chunks are valid */
     /* We already know that oHeapStart != oHeapEnd */
-    Chunk = HeapStart;
-    assert(Chunk_isValid(Chunk, HeapStart, HeapEnd));
+    Chunk = arena->HeapStart;
+    assert(Chunk_isValid(Chunk, arena->HeapStart, arena->HeapEnd));
 
-    Chunk = Chunk_getNextInMem(Chunk, HeapEnd);
+    Chunk = Chunk_getNextInMem(Chunk, arena->HeapEnd);
     while (Chunk != NULL) {
-   		assert(Chunk_isValid(Chunk, HeapStart, HeapEnd));
-   		Chunk = Chunk_getNextInMem(Chunk, HeapEnd);
+   		assert(Chunk_isValid(Chunk, arena->HeapStart, arena->HeapEnd));
+   		Chunk = Chunk_getNextInMem(Chunk, arena->HeapEnd);
    	}
 
    	/* Check to make sure there are no adjacent free chunks */
    	/* We already know that oHeapStart != oHeapEnd */
-   	Chunk = HeapStart;
-   	NextMem = Chunk_getNextInMem(Chunk, HeapEnd);
+   	Chunk = arena->HeapStart;
+   	NextMem = Chunk_getNextInMem(Chunk, arena->HeapEnd);
 
    	while (NextMem != NULL) {
    		if (Chunk_getStatus(Chunk) == CHUNK_FREE && Chunk_getStatus(NextMem) == CHUNK_FREE) {
-   			fprintf(stderr, "Uncoalesced free chunks\n");
+   			reportError("Uncoalesced free chunks", NULL, 0);
        		return 0;
     	}
+   		if (Chunk_isPrevFree(NextMem) != (Chunk_getStatus(Chunk) == CHUNK_FREE)) {
+   			reportError("Prev free bit out of date", NULL, 0);
+   			return 0;
+   		}
    		Chunk = NextMem;
-    	NextMem = Chunk_getNextInMem(NextMem, HeapEnd);
+    	NextMem = Chunk_getNextInMem(NextMem, arena->HeapEnd);
+  	}
+  	if (arena->LastFree != (Chunk_getStatus(Chunk) == CHUNK_FREE) || Chunk_isPrevFree(arena->HeapStart)) {
+  		reportError("Prev free bit out of date at the ends of the heap", NULL, 0);
+  		return 0;
+  	}
+
+  	/* Check that the chunks flagged as zeroed really are */
+  	for (Chunk = arena->HeapStart; Chunk != NULL; Chunk = Chunk_getNextInMem(Chunk, arena->HeapEnd)) {
+  		char *pcByte = (char *)Chunk + (ZEROED_UNITS + 1) * Chunk_getUnitSize();
+  		char *pcEnd = (char *)Chunk + (Chunk_getUnits(Chunk) - 1) * Chunk_getUnitSize();
+
+  		if (!Chunk_isZeroed(Chunk))
+  			continue;
+  		for (; pcByte < pcEnd; pcByte++) {
+  			if (*pcByte != 0) {
+  				reportError("Zeroed chunk holds data", NULL, 0);
+  				return 0;
+  			}
+  		}
   	}
 
   	/* Check if each foward link is matched with the correct backwards link */
   	for (iBin = 0; iBin < NUM_BINS; iBin++) {
-   		Chunk = freebinArray[iBin];
+   		Chunk = arena->freebinArray[iBin];
    		NextList = NULL;
    		if (Chunk != NULL) {
         	NextList = Chunk_getNextInList(Chunk);
       
         	while (NextList != NULL) {
         		if (Chunk_getPrevInList(NextList) != Chunk) {
-               		fprintf(stderr, "Mismatched Foward/Backward Link\n");
+               		reportError("Mismatched Foward/Backward Link", NULL, 0);
                		return 0;
             	}
 
@@ -177,15 +663,15 @@ int HeapMgr_isValid()
     /* Check if each chunk in the bin is of the right size */
     /* Also checks if each chunk in the bin is set to free */
     for (iBin = 0; iBin < NUM_BINS - 1; iBin++) {
-		Chunk = freebinArray[iBin];
+		Chunk = arena->freebinArray[iBin];
 		while (Chunk != NULL) {
 			if ((int)Chunk_getUnits(Chunk) != iBin) {
-            	fprintf(stderr, "Chunk in Wrong Bin, ""Bin = %d\n", iBin);
+            	reportError("Chunk in Wrong Bin", "Bin", iBin);
 				return 0;
 			}
          
         	if (Chunk_getStatus(Chunk) != CHUNK_FREE) {
-            	fprintf(stderr, "Used Chunk in Free List, ""Bin = %d\n", iBin);
+            	reportError("Used Chunk in Free List", "Bin", iBin);
             	return 0;
        		}
 
@@ -194,40 +680,27 @@ int HeapMgr_isValid()
 	}
 
 	/* Make sure all free chunks are in the free list */
-	MemChunk = HeapStart;
-	ListChunk = freebinArray[0];
-   
-   	while (MemChunk != NULL) {
-      	/* If MemChunk is free, make sure it is in free list */
-      	if (Chunk_getStatus(MemChunk) == CHUNK_FREE) {
-			for (iBin = 0; iBin < NUM_BINS; iBin++) {
-           		ListChunk = freebinArray[iBin];
-      
-            	/* Iterate free list to find MemChunk */
-            	while (ListChunk != NULL) {
-            		if (ListChunk == MemChunk)
-               			break;
-               		ListChunk = Chunk_getNextInList(ListChunk);
-            	}
-            
-           		/* If MemChunk found, then break out */
-            	if (ListChunk != NULL)
-               		break;
-        	}
-         
-        	/* If MemChunk wasn't in free list, error */
-        	if (ListChunk == NULL) {
-        		fprintf(stderr, "Free chunks not in free list\n");
-            	return 0;
-        	}
-      	}
-      	MemChunk = Chunk_getNextInMem(MemChunk, HeapEnd);
-    }
+	MemChunk = arena->HeapStart;
+	while (MemChunk != NULL) {
+		if (Chunk_getStatus(MemChunk) == CHUNK_FREE && !ChunkinBin(arena, MemChunk)) {
+			reportError("Free chunks not in free list", NULL, 0);
+			return 0;
+		}
+		MemChunk = Chunk_getNextInMem(MemChunk, arena->HeapEnd);
+	}
+
+	/* Check the shape and order of the large bin tree */
+	if (arena->freebinArray[NUM_BINS - 1] != NULL && Chunk_getColor(arena->freebinArray[NUM_BINS - 1]) != CHUNK_BLACK) {
+		reportError("Red root in large bin tree", NULL, 0);
+		return 0;
+	}
+	if (TreeisValid(arena->freebinArray[NUM_BINS - 1], NULL, NUM_BINS - 2, (size_t)-1) == -1)
+		return 0;
 
     /* Check if the free list in each bin is a complete loop */
     /* i.e. same number of chunks going fowards and backwards and that we end up in the same spot */
     for (iBin = 0; iBin < NUM_BINS; iBin++) {
-    	Chunk = freebinArray[iBin];
+    	Chunk = arena->freebinArray[iBin];
       	if (Chunk != NULL) {
         	/*going fowards*/
         	while (Chunk_getNextInList(Chunk) != NULL) {
@@ -242,14 +715,14 @@ int HeapMgr_isValid()
         	}
       
         	/*should end where we started*/
-         	if (Chunk != freebinArray[iBin]) {
-            	fprintf(stderr, "Doubly Linked-List Not Complete, ""Bin = %d\n", iBin);
+         	if (Chunk != arena->freebinArray[iBin]) {
+            	reportError("Doubly Linked-List Not Complete", "Bin", iBin);
             	return 0;
          	}
       
         	/* Should be the same number of chunks going forwards and backwards */
         	if (i != 0) {
-            	fprintf(stderr, "Number of Forwards Chunks Does Not ""Match Number of Backwards Chunks, Bin = %d\n", iBin);
+            	reportError("Number of Forwards Chunks Does Not Match Number of Backwards Chunks", "Bin", iBin);
             	return 0;
          	}
       	}
@@ -258,397 +731,3078 @@ int HeapMgr_isValid()
 	return 1;
 }
 
-/* ............................................................................. */
-
-int FindBin(size_t Units)
+int SlabsareValid(Arena_T arena)
 
-/* Returns correct bin size */
+/* Return 1 (TRUE) if the arena's lists of slabs with free slots are consistent, or
+	0 (FALSE) otherwise. */
 
 {
-	if (Units > (NUM_BINS - 1))
-		return NUM_BINS - 1;
-	return (int)Units;
+	int iClass;
+	Slab_T Slab, Prev;
+	char *Slot;
+	unsigned int uiFree, uiCapacity;
+
+	for (iClass = 0; iClass < NUM_SLAB_CLASSES; iClass++) {
+		Prev = NULL;
+		for (Slab = arena->slabClasses[iClass]; Slab != NULL; Prev = Slab, Slab = Slab->next) {
+			if ((uintptr_t)Slab % SLAB_SIZE != 0 || (char *)Slab < slabRegion || (char *)Slab >= slabRegion + HEAPMGR_SLAB_REGION_SIZE) {
+				reportError("Slab outside of the slab region", "Class", iClass);
+				return 0;
+			}
+			if (Slab->arena != arena || Slab->prev != Prev || Slab->slotSize != (unsigned int)(iClass + 1) * SLAB_ALIGN) {
+				reportError("Slab in the wrong list", "Class", iClass);
+				return 0;
+			}
+
+			/* Every slot is either free or used, and free slots lie on slot boundaries */
+			uiCapacity = (SLAB_SIZE - SLAB_HEADER_SIZE) / Slab->slotSize;
+			uiFree = 0;
+			for (Slot = Slab->freeSlots; Slot != NULL && uiFree <= uiCapacity; Slot = *(char **)Slot) {
+				if (Slot < (char *)Slab + SLAB_HEADER_SIZE || Slot >= (char *)Slab + SLAB_SIZE
+					|| (size_t)(Slot - (char *)Slab - SLAB_HEADER_SIZE) % Slab->slotSize != 0) {
+					reportError("Misplaced free slot", "Class", iClass);
+					return 0;
+				}
+				uiFree++;
+			}
+			if (uiFree == 0 || uiFree + Slab->used != uiCapacity) {
+				reportError("Slab slot count mismatch", "Class", iClass);
+				return 0;
+			}
+		}
+	}
+
+	return 1;
 }
 
-void removefromList(Chunk_T chunk_ptr)
+void HeapMgr_setCheckLevel(enum HeapMgrCheckLevel eLevel, unsigned long uiInterval)
 
-/* Removes the chunk from the linked structure by adjusting next and prev in list */
+/* Sets how much consistency checking my_malloc and my_free do. uiInterval is the
+	number of checks between two full checks at HEAPMGR_CHECK_PERIODIC, 0 keeps the current one */
 
 {
-	Chunk_T nextinList, previnList;
-	size_t chunk_ptr_val = Chunk_getUnits(chunk_ptr);
-
-	previnList = Chunk_getPrevInList(chunk_ptr);
-	nextinList = Chunk_getNextInList(chunk_ptr);
-	if (previnList != NULL)
-		Chunk_setNextInList(previnList, nextinList);
-	else
-		freebinArray[FindBin(chunk_ptr_val)] = nextinList;
-	if (nextinList != NULL)
-		Chunk_setPrevInList(nextinList, previnList);
+	__atomic_store_n(&checkLevel, eLevel, __ATOMIC_RELAXED);
+	if (uiInterval != 0)
+		__atomic_store_n(&checkInterval, uiInterval, __ATOMIC_RELAXED);
+	__atomic_store_n(&checkCount, 0, __ATOMIC_RELAXED);
 }
 
-void InsertinBin(Chunk_T chunk_ptr)
+int checkHeap(Arena_T arena)
 
-/* Inserts chunk in link structure in respective bin */
+/* Runs HeapMgr_isValid() if the check level asks for it on this call.
+	Returns 1 (TRUE) if the heap is valid or was not checked */
 
-{	
-	Chunk_T binptr, prev_chunk, prevptr = NULL;
-	size_t chunk_size = Chunk_getUnits(chunk_ptr);
-	size_t temp_size = chunk_size;
+{
+	enum HeapMgrCheckLevel level = __atomic_load_n(&checkLevel, __ATOMIC_RELAXED);
+
+	if (level == HEAPMGR_CHECK_FULL)
+		return ArenaisValid(arena);
+	/* Threads of different arenas count under different locks, and any thread may set
+		the level and interval */
+	if (level == HEAPMGR_CHECK_PERIODIC && __atomic_add_fetch(&checkCount, 1, __ATOMIC_RELAXED)
+			% __atomic_load_n(&checkInterval, __ATOMIC_RELAXED) == 0)
+		return ArenaisValid(arena);
+	return 1;
+}
 
-	if (chunk_size > NUM_BINS - 1) {
-		binptr = freebinArray[NUM_BINS - 1];
-		temp_size = NUM_BINS - 1;
-	}
-	else
-		binptr = freebinArray[chunk_size];
+/* ............................................................................. */
 
-	/* Traversing the link list */
-	while (binptr != NULL && Chunk_getUnits(binptr) < chunk_size) {
-		prevptr = binptr;
-		binptr = Chunk_getNextInList(binptr);
-	}
+void markBin(Arena_T arena, int ibin)
 
-	/* Insert before binptr in the link structure */
-	Chunk_setNextInList(chunk_ptr, binptr);
-	if (binptr != NULL) {
-		//printf("In InsertBin() - NON NULL case\n");
-		prev_chunk = Chunk_getPrevInList(binptr);
-		Chunk_setPrevInList(chunk_ptr, prev_chunk);
-		if (prev_chunk == NULL)
-			freebinArray[temp_size] = chunk_ptr;
+/* Marks bin ibin as non empty in both levels of the occupancy bitmap */
 
-		Chunk_setPrevInList(binptr, chunk_ptr);
-		if (prevptr != NULL)
-			Chunk_setNextInList(prevptr, chunk_ptr);
-	}
-	else {
-		//printf("In InsertBin() - NULL case\n");
+{
+	int word = ibin / BITMAP_WORD_BITS;
 
-		if (freebinArray[temp_size] == NULL) {
-			freebinArray[temp_size] = chunk_ptr;
-			Chunk_setPrevInList(chunk_ptr, NULL);
-		}
-		else {
-			//printf("HERE..........................................\n");
-			Chunk_setNextInList(prevptr, chunk_ptr);
-			Chunk_setPrevInList(chunk_ptr, prevptr);
-		}
-	}
+	arena->binBitmap[word] |= (uint64_t)1 << (ibin % BITMAP_WORD_BITS);
+	arena->binSummary |= (uint64_t)1 << word;
 }
 
-Chunk_T useChunk(Chunk_T chunk_ptr, size_t Units, int ibin)
+void unmarkBin(Arena_T arena, int ibin)
 
-/* Uses the chunk. If chunk size is close to Units then remove the chunk from free list and return it.
-	If chunk size is too big split it and re arrange link structure
-	and return pointer to correct memory location slice */
-/* Before returning also be sure to maintain the repective bin link structure from which chunk is being used */
+/* Marks bin ibin as empty, clearing its summary bit if its whole word became empty */
 
 {
-	assert(Chunk_isValid(chunk_ptr, HeapStart, HeapEnd));
-	assert(Chunk_getStatus(chunk_ptr) == CHUNK_FREE);
-	assert(Chunk_getUnits(chunk_ptr) >= Units);
-
-	size_t chunk_ptr_val = Chunk_getUnits(chunk_ptr);
-	size_t splitchunk_size = chunk_ptr_val - Units;
-	Chunk_T temp_ptr, splitchunk;
-
-	/* Allocate all the memory */
-	if (chunk_ptr_val < Units + MIN_UNITS_PER_CHUNK) {
-		/* Update status */
-		Chunk_setStatus(chunk_ptr, CHUNK_INUSE);
+	int word = ibin / BITMAP_WORD_BITS;
 
-		/* Removing chunk_ptr from list */
-		removefromList(chunk_ptr);
+	arena->binBitmap[word] &= ~((uint64_t)1 << (ibin % BITMAP_WORD_BITS));
+	if (arena->binBitmap[word] == 0)
+		arena->binSummary &= ~((uint64_t)1 << word);
+}
 
-		assert(Chunk_isValid(chunk_ptr, HeapStart, HeapEnd));
+int nextNonEmptyBin(Arena_T arena, int ibin)
 
-		return chunk_ptr;
-	}
+/* Returns the smallest non empty bin index >= ibin, or -1 if there is none.
+	Needs at most two count-trailing-zeros operations whatever the distance */
 
-	/* Split the chunk pointed by chunk_ptr */
-	temp_ptr = chunk_ptr;
-	removefromList(chunk_ptr);
-	
-	Chunk_setUnits(temp_ptr, Units);
-	Chunk_setStatus(temp_ptr, CHUNK_INUSE);
+{
+	int word;
+	uint64_t bits, summary;
+
+	if (ibin >= NUM_BINS)
+		return -1;
+
+	/* Look in the rest of ibin's own word first */
+	word = ibin / BITMAP_WORD_BITS;
+	bits = arena->binBitmap[word] & (~(uint64_t)0 << (ibin % BITMAP_WORD_BITS));
+	if (bits != 0)
+		return word * BITMAP_WORD_BITS + __builtin_ctzll(bits);
+
+	/* Otherwise jump to the first non empty word after it */
+	if (word + 1 >= NUM_BITMAP_WORDS)
+		return -1;
+	summary = arena->binSummary & (~(uint64_t)0 << (word + 1));
+	if (summary == 0)
+		return -1;
+	word = __builtin_ctzll(summary);
+
+	return word * BITMAP_WORD_BITS + __builtin_ctzll(arena->binBitmap[word]);
+}
 
-	splitchunk = Chunk_getNextInMem(temp_ptr, HeapEnd);
-	Chunk_setUnits(splitchunk, splitchunk_size);
-	Chunk_setStatus(splitchunk, CHUNK_FREE);
+/* LARGE BIN TREE ................................................................. */
 
-	assert(Chunk_isValid(splitchunk, HeapStart, HeapEnd));
+void replaceChild(Arena_T arena, Chunk_T parent, Chunk_T old_child, Chunk_T new_child)
 
-	/* Depending on size of the split chunk, insert it in correct bin */
-	InsertinBin(splitchunk);
+/* Makes new_child take the place of old_child below parent, or at the root of the tree */
 
-	return temp_ptr;
+{
+	if (parent == NULL)
+		arena->freebinArray[NUM_BINS - 1] = new_child;
+	else if (Chunk_getChild(parent, 0) == old_child)
+		Chunk_setChild(parent, 0, new_child);
+	else
+		Chunk_setChild(parent, 1, new_child);
 }
 
-/* .................................................................................. */
-
-Chunk_T Chunk_coalesce(Chunk_T a_chunk_ptr, Chunk_T b_chunk_ptr)
+void rotateTree(Arena_T arena, Chunk_T node, int dir)
 
-/* Coalesces chunks pointed by a_chunk_ptr and b_chunk_ptr and returns pointer
-	to the newly created chunk */
+/* Rotates the tree around node towards dir : dir == 0 is a left rotation
+	(the right child moves up), dir == 1 is a right rotation */
 
 {
-	/* Chunks should be valid */
-	assert(Chunk_isValid(a_chunk_ptr, HeapStart, HeapEnd));
-	assert(Chunk_isValid(b_chunk_ptr, HeapStart, HeapEnd));
+	Chunk_T pivot = Chunk_getChild(node, !dir);
+	Chunk_T inner = Chunk_getChild(pivot, dir);
 
-	/* Chunks should be free */
-	assert(Chunk_getStatus(a_chunk_ptr) == CHUNK_FREE);
-	assert(Chunk_getStatus(b_chunk_ptr) == CHUNK_FREE);
+	Chunk_setChild(node, !dir, inner);
+	if (inner != NULL)
+		Chunk_setParent(inner, node);
 
-	/* Chunks should be adjacent */
-	assert(Chunk_getNextInMem(a_chunk_ptr, HeapEnd) == b_chunk_ptr); 
+	Chunk_setParent(pivot, Chunk_getParent(node));
+	replaceChild(arena, Chunk_getParent(node), node, pivot);
 
-	size_t a_chunk_size = Chunk_getUnits(a_chunk_ptr);
-	size_t b_chunk_size = Chunk_getUnits(b_chunk_ptr);
-	size_t coalesce_chunk_size = a_chunk_size + b_chunk_size;
+	Chunk_setChild(pivot, dir, node);
+	Chunk_setParent(node, pivot);
+}
 
-	Chunk_setUnits(a_chunk_ptr, coalesce_chunk_size);
+int isBlack(Chunk_T node)
 
-	assert(Chunk_getStatus(a_chunk_ptr) == CHUNK_FREE);
-	assert(Chunk_isValid(a_chunk_ptr, HeapStart, HeapEnd));
+/* Returns 1 if node is black. Missing leaves are black */
 
-	return a_chunk_ptr;
+{
+	return node == NULL || Chunk_getColor(node) == CHUNK_BLACK;
 }
 
-/* .................................................................................. */
-
-Chunk_T getmoreMemory(size_t uiUnits)
+void InsertinTree(Arena_T arena, Chunk_T chunk_ptr)
 
-/* Request more memory from the operating system -- enough to store
-   uiUnits units.  Create a new chunk, coalesce it with adjacent free
-   chunks, and insert into the start of its bin's free list. 
-   Returns the start of the new chunk. */
+/* Inserts chunk in the large bin tree. If a node of the same size exists
+	the chunk is linked right after it in its list, otherwise it becomes a new node */
 
 {
-	Chunk_T Chunk;
-	Chunk_T PrevMem;
-	Chunk_T NewHeapEnd;
-
+	Chunk_T node = arena->freebinArray[NUM_BINS - 1], parent = NULL, uncle, grand, next;
+	size_t chunk_size = Chunk_getUnits(chunk_ptr);
+	int dir = 0;
+
+	/* Look for the node of this size, or the leaf position where it belongs */
+	while (node != NULL) {
+		if (Chunk_getUnits(node) == chunk_size) {
+			next = Chunk_getNextInList(node);
+			Chunk_setNextInList(chunk_ptr, next);
+			Chunk_setPrevInList(chunk_ptr, node);
+			if (next != NULL)
+				Chunk_setPrevInList(next, chunk_ptr);
+			Chunk_setNextInList(node, chunk_ptr);
+			return;
+		}
+		parent = node;
+		dir = Chunk_getUnits(node) < chunk_size;
+		node = Chunk_getChild(node, dir);
+	}
+
+	Chunk_setNextInList(chunk_ptr, NULL);
+	Chunk_setPrevInList(chunk_ptr, NULL);
+	Chunk_setChild(chunk_ptr, 0, NULL);
+	Chunk_setChild(chunk_ptr, 1, NULL);
+	Chunk_setParent(chunk_ptr, parent);
+	Chunk_setColor(chunk_ptr, CHUNK_RED);
+	if (parent == NULL)
+		arena->freebinArray[NUM_BINS - 1] = chunk_ptr;
+	else
+		Chunk_setChild(parent, dir, chunk_ptr);
+
+	/* Restore the red-black properties */
+	node = chunk_ptr;
+	while ((parent = Chunk_getParent(node)) != NULL && Chunk_getColor(parent) == CHUNK_RED) {
+		grand = Chunk_getParent(parent);
+		dir = (parent == Chunk_getChild(grand, 0)) ? 0 : 1;
+		uncle = Chunk_getChild(grand, !dir);
+
+		if (!isBlack(uncle)) {
+			Chunk_setColor(parent, CHUNK_BLACK);
+			Chunk_setColor(uncle, CHUNK_BLACK);
+			Chunk_setColor(grand, CHUNK_RED);
+			node = grand;
+		}
+		else {
+			if (node == Chunk_getChild(parent, !dir)) {
+				node = parent;
+				rotateTree(arena, node, dir);
+				parent = Chunk_getParent(node);
+			}
+			Chunk_setColor(parent, CHUNK_BLACK);
+			Chunk_setColor(grand, CHUNK_RED);
+			rotateTree(arena, grand, !dir);
+		}
+	}
+	Chunk_setColor(arena->freebinArray[NUM_BINS - 1], CHUNK_BLACK);
+}
+
+void removefromTree(Arena_T arena, Chunk_T chunk_ptr)
+
+/* Removes chunk from the large bin tree. A chunk that is not a node is simply
+	unlinked from its list, a node with same size chunks is replaced by the next
+	one in the tree, and only the last chunk of a size is deleted from the tree */
+
+{
+	Chunk_T previnList = Chunk_getPrevInList(chunk_ptr);
+	Chunk_T nextinList = Chunk_getNextInList(chunk_ptr);
+	Chunk_T child, parent, sibling, succ;
+	enum ChunkColor removed_color;
+	int dir;
+
+	/* Not a tree node */
+	if (previnList != NULL) {
+		Chunk_setNextInList(previnList, nextinList);
+		if (nextinList != NULL)
+			Chunk_setPrevInList(nextinList, previnList);
+		return;
+	}
+
+	/* Tree node with same size chunks : the next one takes its place */
+	if (nextinList != NULL) {
+		Chunk_setPrevInList(nextinList, NULL);
+		for (dir = 0; dir < 2; dir++) {
+			child = Chunk_getChild(chunk_ptr, dir);
+			Chunk_setChild(nextinList, dir, child);
+			if (child != NULL)
+				Chunk_setParent(child, nextinList);
+		}
+		Chunk_setParent(nextinList, Chunk_getParent(chunk_ptr));
+		Chunk_setColor(nextinList, Chunk_getColor(chunk_ptr));
+		replaceChild(arena, Chunk_getParent(chunk_ptr), chunk_ptr, nextinList);
+		return;
+	}
+
+	/* Delete the node from the tree */
+	removed_color = Chunk_getColor(chunk_ptr);
+	if (Chunk_getChild(chunk_ptr, 0) == NULL || Chunk_getChild(chunk_ptr, 1) == NULL) {
+		child = Chunk_getChild(chunk_ptr, Chunk_getChild(chunk_ptr, 0) == NULL);
+		parent = Chunk_getParent(chunk_ptr);
+		replaceChild(arena, parent, chunk_ptr, child);
+		if (child != NULL)
+			Chunk_setParent(child, parent);
+	}
+	else {
+		/* Two children : the in order successor moves into the node's place */
+		succ = Chunk_getChild(chunk_ptr, 1);
+		while (Chunk_getChild(succ, 0) != NULL)
+			succ = Chunk_getChild(succ, 0);
+		removed_color = Chunk_getColor(succ);
+		child = Chunk_getChild(succ, 1);
+
+		if (Chunk_getParent(succ) == chunk_ptr)
+			parent = succ;
+		else {
+			parent = Chunk_getParent(succ);
+			replaceChild(arena, parent, succ, child);
+			if (child != NULL)
+				Chunk_setParent(child, parent);
+			Chunk_setChild(succ, 1, Chunk_getChild(chunk_ptr, 1));
+			Chunk_setParent(Chunk_getChild(succ, 1), succ);
+		}
+
+		replaceChild(arena, Chunk_getParent(chunk_ptr), chunk_ptr, succ);
+		Chunk_setParent(succ, Chunk_getParent(chunk_ptr));
+		Chunk_setChild(succ, 0, Chunk_getChild(chunk_ptr, 0));
+		Chunk_setParent(Chunk_getChild(succ, 0), succ);
+		Chunk_setColor(succ, Chunk_getColor(chunk_ptr));
+	}
+
+	if (removed_color == CHUNK_RED)
+		return;
+
+	/* Restore the red-black properties : child carries an extra black */
+	while (child != arena->freebinArray[NUM_BINS - 1] && isBlack(child)) {
+		dir = (child == Chunk_getChild(parent, 0)) ? 0 : 1;
+		sibling = Chunk_getChild(parent, !dir);
+
+		if (!isBlack(sibling)) {
+			Chunk_setColor(sibling, CHUNK_BLACK);
+			Chunk_setColor(parent, CHUNK_RED);
+			rotateTree(arena, parent, dir);
+			sibling = Chunk_getChild(parent, !dir);
+		}
+
+		if (isBlack(Chunk_getChild(sibling, 0)) && isBlack(Chunk_getChild(sibling, 1))) {
+			Chunk_setColor(sibling, CHUNK_RED);
+			child = parent;
+			parent = Chunk_getParent(child);
+		}
+		else {
+			if (isBlack(Chunk_getChild(sibling, !dir))) {
+				Chunk_setColor(Chunk_getChild(sibling, dir), CHUNK_BLACK);
+				Chunk_setColor(sibling, CHUNK_RED);
+				rotateTree(arena, sibling, !dir);
+				sibling = Chunk_getChild(parent, !dir);
+			}
+			Chunk_setColor(sibling, Chunk_getColor(parent));
+			Chunk_setColor(parent, CHUNK_BLACK);
+			Chunk_setColor(Chunk_getChild(sibling, !dir), CHUNK_BLACK);
+			rotateTree(arena, parent, dir);
+			child = arena->freebinArray[NUM_BINS - 1];
+		}
+	}
+	if (child != NULL)
+		Chunk_setColor(child, CHUNK_BLACK);
+}
+
+Chunk_T findinTree(Arena_T arena, size_t Units)
+
+/* Returns the best fit chunk of the large bin tree, i.e. a chunk of the smallest
+	size >= Units, or NULL if there is none. A same size chunk following the node
+	is preferred so that the tree itself does not change when it is used */
+
+{
+	Chunk_T node = arena->freebinArray[NUM_BINS - 1], best = NULL;
+
+	while (node != NULL) {
+		if (Chunk_getUnits(node) >= Units) {
+			best = node;
+			if (Chunk_getUnits(node) == Units)
+				break;
+			node = Chunk_getChild(node, 0);
+		}
+		else
+			node = Chunk_getChild(node, 1);
+	}
+
+	if (best != NULL && Chunk_getNextInList(best) != NULL)
+		return Chunk_getNextInList(best);
+	return best;
+}
+
+/* .................................................................................. */
+
+void removefromList(Arena_T arena, Chunk_T chunk_ptr)
+
+/* Removes the chunk from the linked structure by adjusting next and prev in list */
+
+{
+	Chunk_T nextinList, previnList;
+	size_t chunk_ptr_val = Chunk_getUnits(chunk_ptr);
+
+	arena->binChunks[FindBin(chunk_ptr_val)]--;
+	arena->freeUnits -= chunk_ptr_val;
+
+	if (FindBin(chunk_ptr_val) == NUM_BINS - 1) {
+		removefromTree(arena, chunk_ptr);
+		if (arena->freebinArray[NUM_BINS - 1] == NULL)
+			unmarkBin(arena, NUM_BINS - 1);
+		return;
+	}
+
+	previnList = Chunk_getPrevInList(chunk_ptr);
+	nextinList = Chunk_getNextInList(chunk_ptr);
+	if (previnList != NULL)
+		Chunk_setNextInList(previnList, nextinList);
+	else {
+		arena->freebinArray[FindBin(chunk_ptr_val)] = nextinList;
+		if (nextinList == NULL)
+			unmarkBin(arena, FindBin(chunk_ptr_val));
+	}
+	if (nextinList != NULL)
+		Chunk_setPrevInList(nextinList, previnList);
+}
+
+void InsertinBin(Arena_T arena, Chunk_T chunk_ptr)
+
+/* Inserts chunk in link structure in respective bin. All chunks of an exact size
+	bin have the same size, so the chunk is simply pushed on the bin head (LIFO,
+	the most recently freed memory is the most likely to still be in cache).
+	Only the large bin, where sizes differ, is ordered, by its tree */
+
+{	
+	Chunk_T binptr;
+	int ibin = FindBin(Chunk_getUnits(chunk_ptr));
+
+	markBin(arena, ibin);
+	arena->binChunks[ibin]++;
+	arena->freeUnits += Chunk_getUnits(chunk_ptr);
+
+	if (ibin == NUM_BINS - 1) {
+		InsertinTree(arena, chunk_ptr);
+		return;
+	}
+
+	binptr = arena->freebinArray[ibin];
+
+	Chunk_setNextInList(chunk_ptr, binptr);
+	Chunk_setPrevInList(chunk_ptr, NULL);
+	if (binptr != NULL)
+		Chunk_setPrevInList(binptr, chunk_ptr);
+	arena->freebinArray[ibin] = chunk_ptr;
+}
+
+void setPrevFree(Arena_T arena, Chunk_T chunk_ptr, int free)
+
+/* Records whether chunk_ptr is free in the prev free bit of the chunk that follows it
+	in memory, or in the arena if it is the last chunk of the heap */
+
+{
+	Chunk_T NextMem = Chunk_getNextInMem(chunk_ptr, arena->HeapEnd);
+
+	if (NextMem != NULL)
+		Chunk_setPrevFree(NextMem, free);
+	else
+		arena->LastFree = free;
+}
+
+Chunk_T useChunk(Arena_T arena, Chunk_T chunk_ptr, size_t Units, int ibin)
+
+/* Uses the chunk. If chunk size is close to Units then remove the chunk from free list and return it.
+	If chunk size is too big split it and re arrange link structure
+	and return pointer to correct memory location slice */
+/* Before returning also be sure to maintain the repective bin link structure from which chunk is being used */
+
+{
+	CHECK_CHUNK(chunk_ptr);
+	assert(Chunk_getStatus(chunk_ptr) == CHUNK_FREE);
+	assert(Chunk_getUnits(chunk_ptr) >= Units);
+
+	size_t chunk_ptr_val = Chunk_getUnits(chunk_ptr);
+	size_t splitchunk_size = chunk_ptr_val - Units;
+	int zeroed = Chunk_isZeroed(chunk_ptr);
+	Chunk_T temp_ptr, splitchunk;
+
+	/* Allocate all the memory */
+	if (chunk_ptr_val < Units + MIN_UNITS_PER_CHUNK) {
+		/* Removing chunk_ptr from list */
+		removefromList(arena, chunk_ptr);
+
+		/* Update status */
+		Chunk_setStatus(chunk_ptr, CHUNK_INUSE);
+		Chunk_setZeroed(chunk_ptr, 0);
+		setPrevFree(arena, chunk_ptr, 0);
+
+		CHECK_CHUNK(chunk_ptr);
+
+		return chunk_ptr;
+	}
+
+	/* Split the chunk pointed by chunk_ptr */
+	arena->splits++;
+	temp_ptr = chunk_ptr;
+	removefromList(arena, chunk_ptr);
+	
+	Chunk_setStatus(temp_ptr, CHUNK_INUSE);
+	Chunk_setUnits(temp_ptr, Units);
+
+	/* The rest of a zeroed chunk stays zeroed : its new header lands where the used
+		part keeps its metadata. The chunk after it still follows a free chunk */
+	splitchunk = Chunk_getNextInMem(temp_ptr, arena->HeapEnd);
+	Chunk_setUnits(splitchunk, splitchunk_size);
+	Chunk_setStatus(splitchunk, CHUNK_FREE);
+	Chunk_setPrevFree(splitchunk, 0);
+	Chunk_setZeroed(splitchunk, zeroed);
+
+	CHECK_CHUNK(splitchunk);
+
+	/* Depending on size of the split chunk, insert it in correct bin */
+	InsertinBin(arena, splitchunk);
+
+	return temp_ptr;
+}
+
+/* .................................................................................. */
+
+Chunk_T Chunk_coalesce(Arena_T arena, Chunk_T a_chunk_ptr, Chunk_T b_chunk_ptr)
+
+/* Coalesces chunks pointed by a_chunk_ptr and b_chunk_ptr and returns pointer
+	to the newly created chunk */
+
+{
+	/* Chunks should be valid */
+	CHECK_CHUNK(a_chunk_ptr);
+	CHECK_CHUNK(b_chunk_ptr);
+
+	/* Chunks should be free */
+	assert(Chunk_getStatus(a_chunk_ptr) == CHUNK_FREE);
+	assert(Chunk_getStatus(b_chunk_ptr) == CHUNK_FREE);
+
+	/* Chunks should be adjacent */
+	assert(Chunk_getNextInMem(a_chunk_ptr, arena->HeapEnd) == b_chunk_ptr); 
+
+	size_t a_chunk_size = Chunk_getUnits(a_chunk_ptr);
+	size_t b_chunk_size = Chunk_getUnits(b_chunk_ptr);
+	size_t coalesce_chunk_size = a_chunk_size + b_chunk_size;
+	int zeroed = Chunk_isZeroed(a_chunk_ptr) && Chunk_isZeroed(b_chunk_ptr);
+
+	/* Two zeroed chunks stay zeroed once the metadata between them is cleared :
+		a's footer, b's header and the links that follow it */
+	if (zeroed)
+		memset((char *)b_chunk_ptr - Chunk_getUnitSize(), 0, (ZEROED_UNITS + 2) * Chunk_getUnitSize());
+
+	Chunk_setUnits(a_chunk_ptr, coalesce_chunk_size);
+	Chunk_setZeroed(a_chunk_ptr, zeroed);
+	arena->coalesces++;
+
+	assert(Chunk_getStatus(a_chunk_ptr) == CHUNK_FREE);
+	CHECK_CHUNK(a_chunk_ptr);
+
+	return a_chunk_ptr;
+}
+
+/* .................................................................................. */
+
+Chunk_T getmoreMemory(Arena_T arena, size_t uiUnits)
+
+/* Request more memory from the operating system -- enough to store
+   uiUnits units.  Create a new chunk, coalesce it with adjacent free
+   chunks, and insert into the start of its bin's free list. 
+   Callers needing a chunk of some size count the free chunk at the top
+   of the heap, which the new memory coalesces with, out of uiUnits.
+   Returns the start of the new chunk. */
+
+{
+	Chunk_T Chunk;
+	Chunk_T PrevMem;
+	Chunk_T NewHeapEnd;
+	size_t uiNeeded = uiUnits < MIN_UNITS_PER_CHUNK ? MIN_UNITS_PER_CHUNK : uiUnits;
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t uiLeft;
+
 	if (uiUnits < MAX_SIZE)
 		uiUnits = MAX_SIZE;
 
-	/* Move the program break. */
-	NewHeapEnd = (Chunk_T)((char *)HeapEnd + (uiUnits * Chunk_getUnitSize()));
-	if (NewHeapEnd < HeapEnd)  /* Check for overflow */
-		return NULL;
-	if (brk(NewHeapEnd) == -1)
-		return NULL;
+	if (arena->RegionEnd != NULL) {
+		/* The arena's region is already mapped, just use more of it. Near its end, what is
+			left may be less than MAX_SIZE units but still enough */
+		uiLeft = (size_t)((char *)arena->RegionEnd - (char *)arena->HeapEnd) / UnitSize;
+		if (uiUnits > uiLeft) {
+			if (uiNeeded > uiLeft)
+				return NULL;
+			uiUnits = uiLeft;
+		}
+		NewHeapEnd = (Chunk_T)((char *)arena->HeapEnd + uiUnits * UnitSize);
+	}
+	else {
+		NewHeapEnd = (Chunk_T)((char *)arena->HeapEnd + uiUnits * UnitSize);
+		if (NewHeapEnd < arena->HeapEnd)  /* Check for overflow */
+			return NULL;
+
+		/* Move the program break, unless someone else moved it : the heap must stay contiguous */
+		if (sbrk(0) != (void *)arena->HeapEnd)
+			return NULL;
+		if (brk(NewHeapEnd) == -1)
+			return NULL;
+	}
 
-	Chunk = HeapEnd;
-	HeapEnd = NewHeapEnd;
-	PrevMem = Chunk_getPrevInMem(Chunk, HeapStart);
+	Chunk = arena->HeapEnd;
+	arena->HeapEnd = NewHeapEnd;
+	arena->growths++;
 
-	/* Set the fields of the new chunk */
+	/* Set the fields of the new chunk, the operating system gives it zero filled but the
+		caller's region may hold anything */
 	Chunk_setUnits(Chunk, uiUnits);
 	Chunk_setStatus(Chunk, CHUNK_FREE);
+	Chunk_setPrevFree(Chunk, arena->LastFree);
+	Chunk_setZeroed(Chunk, !arena->External);
+	arena->LastFree = 1;
+	PrevMem = Chunk_getPrevInMem(Chunk, arena->HeapStart);
 
 	/* Coalesce the last chunk in memory if it is free */
-	if ((PrevMem != NULL) && (Chunk_getStatus(PrevMem) == CHUNK_FREE)) {
-		removefromList(PrevMem);
+	if (PrevMem != NULL) {
+		removefromList(arena, PrevMem);
 
-		Chunk = Chunk_coalesce(PrevMem, Chunk);
+		Chunk = Chunk_coalesce(arena, PrevMem, Chunk);
 	}
 
 
 	/* Add the new chunk to the front of its correct bin's free list. */
-	InsertinBin(Chunk);
+	InsertinBin(arena, Chunk);
 
-	assert(Chunk_isValid(Chunk, HeapStart, HeapEnd));
+	CHECK_CHUNK(Chunk);
 	assert(Chunk_getStatus(Chunk) == CHUNK_FREE);
-	assert(Chunk == freebinArray[FindBin(Chunk_getUnits(Chunk))]);
+	assert(ChunkinBin(arena, Chunk));
 
 	return Chunk;
 }
 
+/* RETURNING MEMORY ................................................................... */
+
+size_t trimTop(Arena_T arena, Chunk_T chunk_ptr, size_t min_bytes)
+
+/* If the free chunk, not yet in a bin, is the last one of the arena's heap and has at
+	least min_bytes, gives all of it but MAX_SIZE units back to the operating system :
+	the brk heap lowers the program break, the other arenas discard the pages at the end
+	of their region, but for those in the caller's region, which keep them.
+	Returns the number of bytes given back */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t released;
+	char *NewHeapEnd;
+	int zeroed = Chunk_isZeroed(chunk_ptr);
+
+	if (arena->External || Chunk_getNextInMem(chunk_ptr, arena->HeapEnd) != NULL)
+		return 0;
+	if (Chunk_getUnits(chunk_ptr) * UnitSize < min_bytes)
+		return 0;
+
+	/* Keep the head of the chunk, up to a page boundary */
+	NewHeapEnd = (char *)chunk_ptr + MAX_SIZE * UnitSize;
+	NewHeapEnd = (char *)(((uintptr_t)NewHeapEnd + PageSize - 1) & ~(uintptr_t)(PageSize - 1));
+	if (NewHeapEnd >= (char *)arena->HeapEnd)
+		return 0;
+	released = (size_t)((char *)arena->HeapEnd - NewHeapEnd);
+
+	if (arena->RegionEnd != NULL) {
+		if (madvise(NewHeapEnd, released, MADV_DONTNEED) == -1)
+			return 0;
+	}
+	else {
+		/* Leave the break alone if someone else moved it */
+		if (sbrk(0) != (void *)arena->HeapEnd)
+			return 0;
+		if (brk(NewHeapEnd) == -1)
+			return 0;
+	}
+
+	arena->HeapEnd = (Chunk_T)NewHeapEnd;
+	arena->trims++;
+	Chunk_setUnits(chunk_ptr, (size_t)(NewHeapEnd - (char *)chunk_ptr) / UnitSize);
+	Chunk_setZeroed(chunk_ptr, zeroed);
+
+	return released;
+}
+
+size_t discardFreePages(Chunk_T node)
+
+/* Discards the whole pages inside every chunk of the large bin tree below node, keeping
+	each chunk's header, tree links and footer. The pages read back as zeros, so clearing
+	the partial pages around them leaves the chunk zeroed. Returns the number of bytes discarded */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t released = 0;
+	Chunk_T ptr;
+	char *start, *end;
+
+	if (node == NULL)
+		return 0;
+
+	for (ptr = node; ptr != NULL; ptr = Chunk_getNextInList(ptr)) {
+		start = (char *)ptr + (ZEROED_UNITS + 1) * UnitSize;
+		start = (char *)(((uintptr_t)start + PageSize - 1) & ~(uintptr_t)(PageSize - 1));
+		end = (char *)ptr + (Chunk_getUnits(ptr) - 1) * UnitSize;
+		end = (char *)((uintptr_t)end & ~(uintptr_t)(PageSize - 1));
+		if (end <= start || madvise(start, (size_t)(end - start), MADV_DONTNEED) == -1)
+			continue;
+		released += (size_t)(end - start);
+
+		if (!Chunk_isZeroed(ptr)) {
+			memset((char *)ptr + (ZEROED_UNITS + 1) * UnitSize, 0, (size_t)(start - ((char *)ptr + (ZEROED_UNITS + 1) * UnitSize)));
+			memset(end, 0, (size_t)((char *)ptr + (Chunk_getUnits(ptr) - 1) * UnitSize - end));
+			Chunk_setZeroed(ptr, 1);
+		}
+	}
+
+	return released + discardFreePages(Chunk_getChild(node, 0)) + discardFreePages(Chunk_getChild(node, 1));
+}
+
 /* .................................................................................. */
 
-void *my_malloc(size_t size)
+size_t sizeToUnits(size_t size)
 
-/* Allocate numbytes of memory from the free memory pool and return a pointer to the base of the newly allocated region. 
-	Returns NULL if size is zero or if memory allocation failed */
+/* Returns the number of units of the chunk holding a size bytes region */
 
 {
 	size_t UnitSize = Chunk_getUnitSize();
+
 	size_t Units;
-	int ibin;
-	Chunk_T chunk_ptr;
 
-	if (size == 0)
-		return NULL;
+	/* Payload units, plus one for Header. Only a free chunk has a Footer, in what was
+		the payload */
+	Units = ((size - 1) / UnitSize) + 1 + 1;
+	return Units < MIN_UNITS_PER_CHUNK ? MIN_UNITS_PER_CHUNK : Units;
+}
 
-	/* Determine the number of units the new chunk should contain */
-	Units = ((size - 1) / UnitSize) + 1;
-	Units = Units + 2;	/* For Header and Footer */
+Chunk_T allocChunk(Arena_T arena, size_t Units, int *zeroed)
+
+/* Takes a chunk of at least Units units from the bins, getting more memory from the
+	operating system if no bin has one. Unless zeroed is NULL, sets *zeroed to whether
+	the chunk was zeroed : in use chunks are never flagged, as their neighbours read
+	their header under the lock. Returns NULL if memory allocation failed.
+	The heap lock must be held */
+
+{
+	int ibin;
+	size_t extra;
+	Chunk_T chunk_ptr;
 
 	/* Initialize if this is the first call */
-	if (HeapStart == NULL) {
-		HeapStart = (Chunk_T)sbrk(0);
-		HeapEnd = HeapStart;
+	if (arena->HeapStart == NULL) {
+		arena->HeapStart = (Chunk_T)sbrk(0);
+		arena->HeapEnd = arena->HeapStart;
 	}
 
-	assert(HeapMgr_isValid());
+	CHECK_HEAP();
 
-	/* Traverse through the array and look if bin of required size is available.
-		If it is, allocate it. If not, Check larger bins. */
-	for (ibin = FindBin(Units); ibin < NUM_BINS; ibin++) {
-		chunk_ptr = freebinArray[ibin];
+	/* Look if bin of required size is available. If it is, allocate it.
+		If not, jump straight to the next non empty larger bin using the bitmap. */
+	for (ibin = nextNonEmptyBin(arena, FindBin(Units)); ibin != -1; ibin = nextNonEmptyBin(arena, ibin + 1)) {
+		/* Every chunk of a smaller bin fits, the tree gives the best fit */
+		if (ibin == NUM_BINS - 1)
+			chunk_ptr = findinTree(arena, Units);
+		else
+			chunk_ptr = arena->freebinArray[ibin];
 
-		/* Traverse the link structure starting from index ibin */
-		while (chunk_ptr != NULL) {
-			if (Chunk_getUnits(chunk_ptr) >= Units) {
-				chunk_ptr = useChunk(chunk_ptr, Units, ibin);
+		if (chunk_ptr != NULL) {
+			if (zeroed != NULL)
+				*zeroed = Chunk_isZeroed(chunk_ptr);
+			chunk_ptr = useChunk(arena, chunk_ptr, Units, ibin);
 
-				assert(HeapMgr_isValid());
-				assert(Chunk_isValid(chunk_ptr, HeapStart, HeapEnd));
+			CHECK_HEAP();
+			CHECK_CHUNK(chunk_ptr);
 
-				return (void *)((char *)chunk_ptr + UnitSize);
-			}
-			chunk_ptr = Chunk_getNextInList(chunk_ptr);
+			return chunk_ptr;
 		}
 	}
 
-	/* Required memory is not found. Obtain new memory by doing malloc() */
-	chunk_ptr = getmoreMemory(Units);
+	/* Required memory is not found. Obtain new memory by doing malloc(). The new memory
+		coalesces with the free chunk at the top of the heap, which makes up the rest */
+	extra = Units;
+	if (arena->HeapEnd != arena->HeapStart && arena->LastFree) {
+		chunk_ptr = Chunk_getFreeBefore(arena->HeapEnd, arena->HeapStart);
+		extra -= Chunk_getUnits(chunk_ptr);
+	}
+	chunk_ptr = getmoreMemory(arena, extra);
 
 	/* malloc failed */
 	if (chunk_ptr == NULL) {
-		assert(HeapMgr_isValid());
+		CHECK_HEAP();
 
 		return NULL;
 	}
 
 	/* Chunk is available for use */
-	chunk_ptr = useChunk(chunk_ptr, Units, MAX_SIZE - 1);
+	if (zeroed != NULL)
+		*zeroed = Chunk_isZeroed(chunk_ptr);
+	chunk_ptr = useChunk(arena, chunk_ptr, Units, MAX_SIZE - 1);
 
-	assert(HeapMgr_isValid());
+	CHECK_HEAP();
 
-	return (void *)((char *)chunk_ptr + UnitSize);
+	return chunk_ptr;
 }
 
-/* ................................................................................ */
-
-void my_free(void *region)
+void freeChunk(Arena_T arena, Chunk_T chunk_ptr)
 
-/* Free a previously allocated region. Region points to a region allocated by my_malloc().
-	If region is NULL do nothing */
+/* Returns an in use chunk to the bins, coalescing it with its free neighbours.
+	The heap lock must be held */
 
 {
-	size_t UnitSize = Chunk_getUnitSize();
-	Chunk_T chunk_ptr, PrevMem, NextMem;
-
-	if (region == NULL)
-		return;
+	Chunk_T PrevMem, NextMem;
 
-	assert(HeapMgr_isValid());
-
-	chunk_ptr = (Chunk_T)((char*)region - UnitSize);
-	assert(Chunk_isValid(chunk_ptr, HeapStart, HeapEnd));
+	CHECK_HEAP();
+	CHECK_CHUNK(chunk_ptr);
 
 	Chunk_setStatus(chunk_ptr, CHUNK_FREE);
-	NextMem = Chunk_getNextInMem(chunk_ptr, HeapEnd);
-	PrevMem = Chunk_getPrevInMem(chunk_ptr, HeapStart);
+	NextMem = Chunk_getNextInMem(chunk_ptr, arena->HeapEnd);
+	PrevMem = Chunk_getPrevInMem(chunk_ptr, arena->HeapStart);
 
 	/* If PrevMem is also free coalesce the two chunks */
-	if (PrevMem != NULL && Chunk_getStatus(PrevMem) == CHUNK_FREE) {
-		removefromList(PrevMem);
+	if (PrevMem != NULL) {
+		removefromList(arena, PrevMem);
 
-		chunk_ptr = Chunk_coalesce(PrevMem, chunk_ptr);
+		chunk_ptr = Chunk_coalesce(arena, PrevMem, chunk_ptr);
 
-		assert(Chunk_isValid(chunk_ptr, HeapStart, HeapEnd));
+		CHECK_CHUNK(chunk_ptr);
 		assert(Chunk_getStatus(chunk_ptr) == CHUNK_FREE);
 	}
 	
 	/* If NextMem is also free coalesce the two chunks */
 	if (NextMem != NULL && Chunk_getStatus(NextMem) == CHUNK_FREE) {
-		removefromList(NextMem);
+		removefromList(arena, NextMem);
 
-		chunk_ptr = Chunk_coalesce(chunk_ptr, NextMem);
+		chunk_ptr = Chunk_coalesce(arena, chunk_ptr, NextMem);
 
-		assert(Chunk_isValid(chunk_ptr, HeapStart, HeapEnd));
+		CHECK_CHUNK(chunk_ptr);
 		assert(Chunk_getStatus(chunk_ptr) == CHUNK_FREE);
 	}
 
+	/* Give the top of the heap back if it has grown too big */
+	trimTop(arena, chunk_ptr, __atomic_load_n(&trimThreshold, __ATOMIC_RELAXED));
+
 	/* Place final bigger chunk in starting of linked structure for correct bin */
-	InsertinBin(chunk_ptr);
+	InsertinBin(arena, chunk_ptr);
+	setPrevFree(arena, chunk_ptr, 1);
 
-	assert(HeapMgr_isValid());
+	CHECK_HEAP();
 }
 
-/* .................................................................................. */
+/* SLABS .............................................................................. */
 
-void *my_calloc(size_t nitems, size_t size)
+void reserveSlabRegion()
 
-/* Allocate the requested memory, initialize it to zero and returns a pointer to the beginning of allocated region.
-	Returns NULL if memory allocation failed */
+/* Reserves the slab region, backed only as slabs are carved from it. Its first pages
+	hold the stack of free slab indices */
 
-{	
-	char *chunk_ptr;
-	size_t total_size = nitems * size;
-	chunk_ptr = (char *)my_malloc(total_size);
+{
+	char *region;
 
-	/* Setting all bytes to zero */
-	if (chunk_ptr != NULL)
-		chunk_ptr = memset(chunk_ptr, 0, (int)total_size);
+	region = mmap(NULL, HEAPMGR_SLAB_REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (region == MAP_FAILED)
+		return;
 
-	return chunk_ptr;
+	freeSlabs = (uint32_t *)region;
+	slabCount = (unsigned int)INDEX_SLABS;
+	__atomic_store_n(&slabRegion, region, __ATOMIC_RELEASE);
 }
 
-/* .................................................................................. */
+int isSlot(const void *region)
 
-void *my_realloc(void *ptr, size_t size)
+/* Returns 1 (TRUE) if region is a slot of a slab, or 0 (FALSE) if it is a chunk's payload */
 
-/* Resize the memory block pointed to by ptr that was previously allocated with a call to my_malloc or my_calloc.
-	Returns a pointer to the newly allocated memory, or NULL if the request fails. */
+{
+	char *base = __atomic_load_n(&slabRegion, __ATOMIC_RELAXED);
 
-{	
-	Chunk_T ptr_header, splitchunk;
-	size_t initialsize;
-	size_t UnitSize = Chunk_getUnitSize();
-	size_t size_units, splitchunk_size_units;	
+	return base != NULL && (uintptr_t)((const char *)region - base) < HEAPMGR_SLAB_REGION_SIZE;
+}
 
-	Chunk_T new_ptr;
+Slab_T findSlab(const void *slot)
 
-	ptr_header = (Chunk_T)((char *)ptr - UnitSize);
-	initialsize = Chunk_getUnits(ptr_header);
-	size_units = (size - 1) / UnitSize + 3;
+/* Returns the slab holding slot */
 
-	/* Change the chunk units in the header and return same pointer */
-	if (size_units < initialsize - 3) {
-		Chunk_setUnits(ptr_header, size_units);
+{
+	return (Slab_T)((uintptr_t)slot & ~(uintptr_t)(SLAB_SIZE - 1));
+}
 
-		/* Free next pointers */
-		/* Split the chunk, set size and status of the splitchunk and insert it in freebinArray */
-		splitchunk = Chunk_getNextInMem(ptr_header, HeapEnd);
-		splitchunk_size_units = initialsize - size_units;
+Slab_T newSlab(Arena_T arena, int iclass)
 
-		Chunk_setUnits(splitchunk, splitchunk_size_units);
-		Chunk_setStatus(splitchunk, CHUNK_INUSE);
+/* Takes an empty slab, given back or never used, and sets it up for the arena with
+	slots of class iclass, all free. Returns NULL if the slab region is full */
 
-		my_free((Chunk_T)((char *)splitchunk + UnitSize));
+{
+	unsigned int index, size = (unsigned int)(iclass + 1) * SLAB_ALIGN;
+	Slab_T slab;
+	char *slot, *last;
+
+	pthread_once(&slabRegionOnce, reserveSlabRegion);
+	if (slabRegion == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&slabLock);
+	if (freeSlabCount > 0) {
+		index = freeSlabs[--freeSlabCount];
+		if (cleanSlabCount > freeSlabCount)
+			cleanSlabCount = freeSlabCount;
+	}
+	else if (slabCount < MAX_SLABS)
+		index = slabCount++;
+	else
+		index = 0;
+	pthread_mutex_unlock(&slabLock);
+	if (index == 0)
+		return NULL;
+
+	slab = (Slab_T)(slabRegion + (size_t)index * SLAB_SIZE);
+	slab->arena = arena;
+	slab->next = NULL;
+	slab->prev = NULL;
+	slab->slotSize = size;
+	slab->used = 0;
+
+	/* Link the slots in address order */
+	slab->freeSlots = (char *)slab + SLAB_HEADER_SIZE;
+	last = (char *)slab + SLAB_HEADER_SIZE + ((SLAB_SIZE - SLAB_HEADER_SIZE) / size - 1) * size;
+	for (slot = slab->freeSlots; slot < last; slot += size)
+		*(char **)slot = slot + size;
+	*(char **)last = NULL;
+
+	return slab;
+}
+
+void releaseSlab(Slab_T slab)
+
+/* Gives an empty slab back to the slab region for any arena and slot size to reuse */
+
+{
+	pthread_mutex_lock(&slabLock);
+	freeSlabs[freeSlabCount++] = (uint32_t)(((char *)slab - slabRegion) / SLAB_SIZE);
+	pthread_mutex_unlock(&slabLock);
+}
+
+size_t discardFreeSlabs()
+
+/* Discards the pages of the empty slabs given back since the last call. They read back
+	as zeros. Returns the number of bytes discarded */
+
+{
+	size_t released = 0;
+
+	if (__atomic_load_n(&slabRegion, __ATOMIC_ACQUIRE) == NULL)
+		return 0;
+
+	pthread_mutex_lock(&slabLock);
+	for (; cleanSlabCount < freeSlabCount; cleanSlabCount++)
+		if (madvise(slabRegion + (size_t)freeSlabs[cleanSlabCount] * SLAB_SIZE, SLAB_SIZE, MADV_DONTNEED) == 0)
+			released += SLAB_SIZE;
+	pthread_mutex_unlock(&slabLock);
+
+	return released;
+}
+
+void unlinkSlab(Arena_T arena, Slab_T slab)
+
+/* Removes the slab from the arena's list of slabs with free slots */
+
+{
+	int iclass = (int)(slab->slotSize / SLAB_ALIGN) - 1;
+
+	if (slab->prev != NULL)
+		slab->prev->next = slab->next;
+	else
+		arena->slabClasses[iclass] = slab->next;
+	if (slab->next != NULL)
+		slab->next->prev = slab->prev;
+	slab->next = NULL;
+	slab->prev = NULL;
+}
+
+void *allocSlot(Arena_T arena, int iclass)
+
+/* Takes a slot of class iclass from the arena's slabs, setting up a new slab if none
+	has a free slot. Returns NULL if the slab region is full. The arena's lock must be held */
+
+{
+	Slab_T slab = arena->slabClasses[iclass];
+	void *slot;
+
+	if (slab == NULL) {
+		slab = newSlab(arena, iclass);
+		if (slab == NULL)
+			return NULL;
+		arena->slabClasses[iclass] = slab;
+	}
+
+	slot = slab->freeSlots;
+	slab->freeSlots = *(void **)slot;
+	slab->used++;
+
+	/* A full slab leaves the list until one of its slots is freed */
+	if (slab->freeSlots == NULL)
+		unlinkSlab(arena, slab);
+
+	CHECK_SLABS();
+
+	return slot;
+}
+
+void freeSlot(Arena_T arena, void *slot)
+
+/* Returns a slot to its slab. An empty slab is given back unless it is the only one of
+	its size with free slots. The arena's lock must be held */
+
+{
+	Slab_T slab = findSlab(slot);
+	int iclass = (int)(slab->slotSize / SLAB_ALIGN) - 1;
+
+	assert(slab->arena == arena);
+	assert(slab->used > 0);
+
+	/* A full slab goes back in the list */
+	if (slab->freeSlots == NULL) {
+		slab->next = arena->slabClasses[iclass];
+		if (slab->next != NULL)
+			slab->next->prev = slab;
+		arena->slabClasses[iclass] = slab;
+	}
+
+	*(void **)slot = slab->freeSlots;
+	slab->freeSlots = slot;
+	slab->used--;
+
+	if (slab->used == 0 && (slab->prev != NULL || slab->next != NULL)) {
+		unlinkSlab(arena, slab);
+		releaseSlab(slab);
+	}
+
+	CHECK_SLABS();
+}
+
+/* ARENAS ............................................................................. */
+
+unsigned int loadArenaCount()
+
+/* Returns the number of arenas created so far, including the main arena */
+
+{
+	return __atomic_load_n(&createdArenas, __ATOMIC_ACQUIRE);
+}
+
+Arena_T createArena()
+
+/* Reserves a HEAPMGR_ARENA_SIZE aligned region and sets up a new arena at its start,
+	with an empty heap right after it. Returns NULL if the region cannot be mapped */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t size = HEAPMGR_ARENA_SIZE;
+	char *region, *aligned;
+	Arena_T arena;
+
+	/* Map twice the size and unmap what lies outside the aligned region */
+	region = mmap(NULL, 2 * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (region == MAP_FAILED)
+		return NULL;
+	aligned = (char *)(((uintptr_t)region + size - 1) & ~(uintptr_t)(size - 1));
+	if (aligned != region)
+		munmap(region, aligned - region);
+	munmap(aligned + size, region + size - aligned);
+
+	/* The mapping is zero filled, so the bins are already empty */
+	arena = (Arena_T)aligned;
+	pthread_mutex_init(&arena->lock, NULL);
+	arena->HeapStart = (Chunk_T)(aligned + ((sizeof(Arena) - 1) / UnitSize + 1) * UnitSize);
+	arena->HeapEnd = arena->HeapStart;
+	arena->RegionEnd = (Chunk_T)(aligned + size);
+
+	return arena;
+}
+
+Arena_T getArena(unsigned int index)
+
+/* Returns arena index (modulo the arena count), creating the arenas up to it if
+	they do not exist yet. Returns the main arena if an arena cannot be created */
+
+{
+	Arena_T arena;
+	unsigned int created;
+	long processors;
+
+	pthread_mutex_lock(&arenaListLock);
+
+	if (numArenas == 0) {
+		processors = sysconf(_SC_NPROCESSORS_ONLN);
+		numArenas = processors < 1 ? 1 : processors > HEAPMGR_MAX_ARENAS ? HEAPMGR_MAX_ARENAS : (unsigned int)processors;
+	}
+	index %= numArenas;
+
+	for (created = createdArenas; created <= index; created++) {
+		arena = createArena();
+		if (arena == NULL)
+			break;
+		arenaList[created] = arena;
+		__atomic_store_n(&createdArenas, created + 1, __ATOMIC_RELEASE);
+	}
+	arena = index < createdArenas ? arenaList[index] : &mainArena;
+
+	pthread_mutex_unlock(&arenaListLock);
+
+	return arena;
+}
+
+Arena_T findArena(Chunk_T chunk_ptr)
+
+/* Returns the arena owning chunk_ptr : the arena at the start of the aligned region
+	containing it, or the main arena if no arena lives there */
+
+{
+	Arena_T base = (Arena_T)((uintptr_t)chunk_ptr & ~(uintptr_t)(HEAPMGR_ARENA_SIZE - 1));
+	unsigned int i, created = loadArenaCount();
+
+	for (i = 1; i < created; i++)
+		if (arenaList[i] == base)
+			return base;
+	return &mainArena;
+}
+
+void pushRemoteFrees(Arena_T arena, Chunk_T first, Chunk_T last)
+
+/* Pushes the list of in use chunks from first to last, linked by next in list, on the
+	remote free stack of their arena. Never blocks */
+
+{
+	Chunk_T head = __atomic_load_n(&arena->remoteFrees, __ATOMIC_RELAXED);
+
+	do {
+		Chunk_setNextInList(last, head);
+	} while (!__atomic_compare_exchange_n(&arena->remoteFrees, &head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void pushRemoteSlots(Arena_T arena, void *first, void *last)
+
+/* Pushes the list of slots from first to last, linked by their first word, on the
+	remote slot stack of their arena. Never blocks */
+
+{
+	void *head = __atomic_load_n(&arena->remoteSlots, __ATOMIC_RELAXED);
+
+	do {
+		*(void **)last = head;
+	} while (!__atomic_compare_exchange_n(&arena->remoteSlots, &head, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void drainRemoteFrees(Arena_T arena)
+
+/* Frees, in bulk, the chunks and slots other threads pushed on the arena's remote free
+	stacks. The arena's lock must be held */
+
+{
+	Chunk_T chunk_ptr, next;
+	void *slot, *next_slot;
+
+	if (__atomic_load_n(&arena->remoteSlots, __ATOMIC_RELAXED) != NULL) {
+		slot = __atomic_exchange_n(&arena->remoteSlots, NULL, __ATOMIC_ACQUIRE);
+		while (slot != NULL) {
+			next_slot = *(void **)slot;
+			freeSlot(arena, slot);
+			slot = next_slot;
+		}
+	}
+
+	if (__atomic_load_n(&arena->remoteFrees, __ATOMIC_RELAXED) == NULL)
+		return;
+
+	chunk_ptr = __atomic_exchange_n(&arena->remoteFrees, NULL, __ATOMIC_ACQUIRE);
+	while (chunk_ptr != NULL) {
+		next = Chunk_getNextInList(chunk_ptr);
+		freeChunk(arena, chunk_ptr);
+		chunk_ptr = next;
+	}
+}
+
+void drainIdleArena(Arena_T arena)
+
+/* Drains the arena's remote free stacks if its lock is free, without waiting for it.
+	Otherwise whoever holds the lock drains them : an arena whose threads have all exited
+	would keep them forever */
+
+{
+	if (pthread_mutex_trylock(&arena->lock) == 0) {
+		drainRemoteFrees(arena);
+		pthread_mutex_unlock(&arena->lock);
+	}
+}
+
+Arena_T lockThreadArena()
+
+/* Locks and returns the arena of this thread, assigning one round robin on the thread's
+	first call. If the arena is busy, the thread moves for good to the first arena that
+	is not, so that threads also spread by contention. Blocks only if all arenas are busy.
+	The chunks other threads freed remotely into the arena are freed before returning */
+
+{
+	Arena_T arena = threadArena;
+	unsigned int i, created;
+
+	if (arena == NULL)
+		arena = threadArena = getArena(__atomic_fetch_add(&nextArena, 1, __ATOMIC_RELAXED));
+
+	if (pthread_mutex_trylock(&arena->lock) != 0) {
+		created = loadArenaCount();
+		for (i = 0; i < created && i < numArenas; i++) {
+			if (arenaList[i] != arena && pthread_mutex_trylock(&arenaList[i]->lock) == 0)
+				break;
+		}
+
+		if (i < created && i < numArenas)
+			arena = threadArena = arenaList[i];
+		else
+			pthread_mutex_lock(&arena->lock);
+	}
+
+	drainRemoteFrees(arena);
+	return arena;
+}
+
+Chunk_T allocFromOtherArena(Arena_T tried, size_t Units, int *zeroed)
+
+/* Called when the arena tried could not allocate Units units, because its region is
+	full or the program break was moved by someone else. Tries the other arenas, creating
+	a new one if none can, and moves this thread to the one that succeeds. Sets *zeroed
+	like allocChunk. Returns NULL if memory allocation failed */
+
+{
+	Arena_T arena;
+	Chunk_T chunk_ptr;
+	unsigned int i;
+
+	for (i = 0; i <= loadArenaCount() && i < HEAPMGR_MAX_ARENAS; i++) {
+		if (i < loadArenaCount())
+			arena = arenaList[i];
+		else {
+			/* Every arena is exhausted : add one beyond the arena count */
+			pthread_mutex_lock(&arenaListLock);
+			arena = NULL;
+			if (createdArenas == i && (arena = createArena()) != NULL) {
+				arenaList[i] = arena;
+				__atomic_store_n(&createdArenas, i + 1, __ATOMIC_RELEASE);
+			}
+			pthread_mutex_unlock(&arenaListLock);
+			if (arena == NULL)
+				return NULL;
+		}
+		if (arena == tried)
+			continue;
+
+		pthread_mutex_lock(&arena->lock);
+		drainRemoteFrees(arena);
+		chunk_ptr = allocChunk(arena, Units, zeroed);
+		pthread_mutex_unlock(&arena->lock);
+
+		if (chunk_ptr != NULL) {
+			threadArena = arena;
+			return chunk_ptr;
+		}
+	}
+
+	return NULL;
+}
+
+void HeapMgr_setArenaCount(unsigned int uiCount)
+
+/* Sets the number of arenas threads are spread over */
+
+{
+	pthread_mutex_lock(&arenaListLock);
+	numArenas = uiCount < 1 ? 1 : uiCount > HEAPMGR_MAX_ARENAS ? HEAPMGR_MAX_ARENAS : uiCount;
+	pthread_mutex_unlock(&arenaListLock);
+}
+
+int HeapMgr_isValid()
+
+/* Return 1 (TRUE) if every arena that has a heap is in a valid state, or
+	0 (FALSE) otherwise. */
+
+{
+	Arena_T arena;
+	unsigned int i;
+	int valid = 1;
+
+	for (i = 0; valid && i < loadArenaCount(); i++) {
+		arena = arenaList[i];
+		pthread_mutex_lock(&arena->lock);
+		valid = SlabsareValid(arena);
+		if (valid && arena->HeapStart != NULL)
+			valid = ArenaisValid(arena);
+		pthread_mutex_unlock(&arena->lock);
+	}
+
+	return valid;
+}
+
+void prepareFork()
+
+/* Takes every lock of the heap manager before fork(), in the order they nest in :
+	the arena list, each arena, the slabs, the statistics and the trace, so that the
+	child does not inherit a heap that another thread was in the middle of changing */
+
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&arenaListLock);
+	for (i = 0; i < createdArenas; i++)
+		pthread_mutex_lock(&arenaList[i]->lock);
+	pthread_mutex_lock(&slabLock);
+	pthread_mutex_lock(&statsLock);
+	pthread_mutex_lock(&traceLock);
+}
+
+void resumeAfterFork()
+
+/* Releases the locks taken by prepareFork in the parent */
+
+{
+	unsigned int i;
+
+	pthread_mutex_unlock(&traceLock);
+	pthread_mutex_unlock(&statsLock);
+	pthread_mutex_unlock(&slabLock);
+	for (i = createdArenas; i > 0; i--)
+		pthread_mutex_unlock(&arenaList[i - 1]->lock);
+	pthread_mutex_unlock(&arenaListLock);
+}
+
+void resetAfterFork()
+
+/* Reinitializes the locks taken by prepareFork in the child, whose only thread
+	does not own them */
+
+{
+	unsigned int i;
+
+	pthread_mutex_init(&traceLock, NULL);
+	pthread_mutex_init(&statsLock, NULL);
+	pthread_mutex_init(&slabLock, NULL);
+	for (i = 0; i < createdArenas; i++)
+		pthread_mutex_init(&arenaList[i]->lock, NULL);
+	pthread_mutex_init(&arenaListLock, NULL);
+}
+
+__attribute__((constructor)) void registerForkHandlers()
+
+/* Keeps the heap usable in the child of a multithreaded fork() */
+
+{
+	pthread_atfork(prepareFork, resumeAfterFork, resetAfterFork);
+}
+
+/* DIRECT MAPPINGS .................................................................... */
+
+Chunk_T mapChunk(size_t Units)
+
+/* Maps a chunk of at least Units units directly from the operating system, outside of
+	any arena. The chunk spans its whole mapping, which is already zero filled.
+	Returns NULL if the mapping failed */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t length;
+	Chunk_T chunk_ptr;
+
+	/* Round up to whole pages, checking for overflow */
+	if (Units > ((size_t)-1 - PageSize) / UnitSize)
+		return NULL;
+	length = (Units * UnitSize + PageSize - 1) & ~(PageSize - 1);
+
+	chunk_ptr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk_ptr == MAP_FAILED)
+		return NULL;
+
+	Chunk_setStatus(chunk_ptr, CHUNK_INUSE);
+	Chunk_setUnits(chunk_ptr, length / UnitSize);
+	Chunk_setMapping(chunk_ptr, chunk_ptr);
+	__atomic_fetch_add(&mappedBytes, length, __ATOMIC_RELAXED);
+
+	return chunk_ptr;
+}
+
+void unmapChunk(Chunk_T chunk_ptr)
+
+/* Gives the mapping of a mapped chunk back to the operating system */
+
+{
+	char *mapping = Chunk_getMapping(chunk_ptr);
+	size_t length = (size_t)((char *)chunk_ptr - mapping) + Chunk_getUnits(chunk_ptr) * Chunk_getUnitSize();
+
+	munmap(mapping, length);
+	__atomic_fetch_sub(&mappedBytes, length, __ATOMIC_RELAXED);
+}
+
+void HeapMgr_setMmapThreshold(size_t uiBytes)
+
+/* Sets the size from which requests get their own memory mapping */
+
+{
+	__atomic_store_n(&mmapThreshold, uiBytes, __ATOMIC_RELAXED);
+}
+
+void HeapMgr_setTrimThreshold(size_t uiBytes)
+
+/* Sets the size of the free chunk at the top of a heap from which my_free shrinks the heap */
+
+{
+	__atomic_store_n(&trimThreshold, uiBytes, __ATOMIC_RELAXED);
+}
+
+/* TRACING ............................................................................ */
+
+uint64_t traceClock()
+
+/* Returns the monotonic time in nanoseconds */
+
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+void drainTraceRing(TraceRing *ring)
+
+/* Writes the records of the ring not written out yet to the trace file, as one block,
+	or drops them if there is no trace file. traceLock must be held */
+
+{
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	unsigned int tail = ring->tail;
+	unsigned int first;
+	struct HeapMgrTraceBlock block;
+
+	if (head == tail)
+		return;
+
+	if (traceFd >= 0) {
+		block.uiThread = ring->thread;
+		block.uiCount = head - tail;
+		first = TRACE_RING_RECORDS - tail % TRACE_RING_RECORDS;
+		if (first > head - tail)
+			first = head - tail;
+
+		/* The trace only loses records if the file cannot be written */
+		if (write(traceFd, &block, sizeof(block)) == (ssize_t)sizeof(block)
+				&& write(traceFd, &ring->records[tail % TRACE_RING_RECORDS], first * sizeof(ring->records[0])) >= 0
+				&& head - tail > first)
+			(void)!write(traceFd, ring->records, (head - tail - first) * sizeof(ring->records[0]));
+	}
+
+	__atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+}
+
+TraceRing *newTraceRing()
+
+/* Maps a trace buffer for this thread and adds it to traceRings.
+	Returns NULL if the mapping failed */
+
+{
+	TraceRing *ring = mmap(NULL, sizeof(TraceRing), PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (ring == MAP_FAILED)
+		return NULL;
+
+	pthread_mutex_lock(&traceLock);
+	ring->thread = traceThreads++;
+	ring->prev = NULL;
+	ring->next = traceRings;
+	if (traceRings != NULL)
+		traceRings->prev = ring;
+	traceRings = ring;
+	pthread_mutex_unlock(&traceLock);
+
+	return ring;
+}
+
+void releaseTraceRing(TraceRing *ring)
+
+/* Writes out what is left in the trace buffer of an exiting thread and unmaps it */
+
+{
+	pthread_mutex_lock(&traceLock);
+	drainTraceRing(ring);
+	if (ring->prev != NULL)
+		ring->prev->next = ring->next;
+	else
+		traceRings = ring->next;
+	if (ring->next != NULL)
+		ring->next->prev = ring->prev;
+	pthread_mutex_unlock(&traceLock);
+
+	munmap(ring, sizeof(TraceRing));
+}
+
+void traceEvent(enum HeapMgrTraceOp eOp, uint64_t id, uint64_t aux, uint64_t size)
+
+/* Records an event in this thread's trace buffer, writing the buffer out first if it is
+	full. The caller must have registered the thread's cache, so that the buffer is
+	written out when the thread exits */
+
+{
+	TraceRing *ring = tcache.traceRing;
+	struct HeapMgrTraceRecord *record;
+	unsigned int head;
+
+	if (ring == NULL) {
+		ring = newTraceRing();
+		if (ring == NULL)
+			return;
+		tcache.traceRing = ring;
+	}
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == TRACE_RING_RECORDS) {
+		pthread_mutex_lock(&traceLock);
+		drainTraceRing(ring);
+		pthread_mutex_unlock(&traceLock);
+	}
+
+	record = &ring->records[head % TRACE_RING_RECORDS];
+	record->ulOpTime = (uint64_t)eOp << HEAPMGR_TRACE_OP_SHIFT
+		| ((traceClock() - __atomic_load_n(&traceStart, __ATOMIC_RELAXED)) & HEAPMGR_TRACE_TIME_MASK);
+	record->ulId = id;
+	record->ulAux = aux;
+	record->ulSize = size;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int HeapMgr_startTrace(const char *pcPath)
+
+/* Creates the trace file pcPath and starts tracing. Returns 0 on success, or -1 with
+	errno set if a trace is already running or the file cannot be created */
+
+{
+	TraceRing *ring;
+	int fd;
+
+	pthread_mutex_lock(&traceLock);
+	if (traceFd >= 0) {
+		pthread_mutex_unlock(&traceLock);
+		errno = EBUSY;
+		return -1;
+	}
+
+	fd = open(pcPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0 || write(fd, HEAPMGR_TRACE_MAGIC, 8) != 8) {
+		if (fd >= 0)
+			close(fd);
+		pthread_mutex_unlock(&traceLock);
+		return -1;
+	}
+
+	/* Drop what was recorded while a previous trace stopped */
+	for (ring = traceRings; ring != NULL; ring = ring->next)
+		drainTraceRing(ring);
+
+	traceFd = fd;
+	__atomic_store_n(&traceStart, traceClock(), __ATOMIC_RELAXED);
+	__atomic_store_n(&traceOn, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&traceLock);
+
+	return 0;
+}
+
+void HeapMgr_stopTrace(void)
+
+/* Stops tracing, writes out every thread's trace buffer and closes the trace file */
+
+{
+	TraceRing *ring;
+
+	__atomic_store_n(&traceOn, 0, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&traceLock);
+	for (ring = traceRings; ring != NULL; ring = ring->next)
+		drainTraceRing(ring);
+	if (traceFd >= 0)
+		close(traceFd);
+	traceFd = -1;
+	pthread_mutex_unlock(&traceLock);
+}
+
+__attribute__((constructor)) void startTraceFromEnvironment()
+
+/* Traces the whole run into the file named by the HEAPMGR_TRACE environment variable,
+	if it is set */
+
+{
+	const char *path = getenv("HEAPMGR_TRACE");
+
+	if (path != NULL && *path != '\0' && HeapMgr_startTrace(path) == 0)
+		atexit(HeapMgr_stopTrace);
+}
+
+/* THREAD CACHE ....................................................................... */
+
+void flushTCacheBin(int units, unsigned int count)
+
+/* Returns the count least recently cached chunks of the units bin of this thread's
+	cache to their arenas, without ever waiting on the lock of another thread's arena */
+
+{
+	Arena_T arena;
+	Chunk_T chunk_ptr, next, last;
+	unsigned int keep;
+
+	assert(count <= tcache.count[units]);
+
+	/* The most recently freed chunks are at the head, keep them */
+	keep = tcache.count[units] - count;
+	chunk_ptr = tcache.bins[units];
+	if (keep == 0)
+		tcache.bins[units] = NULL;
+	else {
+		while (--keep > 0)
+			chunk_ptr = Chunk_getNextInList(chunk_ptr);
+		next = Chunk_getNextInList(chunk_ptr);
+		Chunk_setNextInList(chunk_ptr, NULL);
+		chunk_ptr = next;
+	}
+	tcache.count[units] -= count;
+
+	/* Cached chunks may come from several arenas. Free each run of chunks of this thread's
+		arena under one lock, and push each run of another arena on its remote free stack */
+	while (chunk_ptr != NULL) {
+		arena = findArena(chunk_ptr);
+		last = chunk_ptr;
+		while ((next = Chunk_getNextInList(last)) != NULL && findArena(next) == arena)
+			last = next;
+		Chunk_setNextInList(last, NULL);
+
+		if (arena == threadArena) {
+			pthread_mutex_lock(&arena->lock);
+			while (chunk_ptr != NULL) {
+				last = Chunk_getNextInList(chunk_ptr);
+				freeChunk(arena, chunk_ptr);
+				chunk_ptr = last;
+			}
+			pthread_mutex_unlock(&arena->lock);
+		}
+		else {
+			pushRemoteFrees(arena, chunk_ptr, last);
+			drainIdleArena(arena);
+		}
+
+		chunk_ptr = next;
+	}
+}
+
+void flushTCacheSlots(int iclass, unsigned int count)
+
+/* Returns the count least recently cached slots of class iclass of this thread's cache
+	to their slabs, like flushTCacheBin */
+
+{
+	Arena_T arena;
+	void *slot, *next, *last;
+	unsigned int keep;
+
+	assert(count <= tcache.slotCount[iclass]);
+
+	/* The most recently freed slots are at the head, keep them */
+	keep = tcache.slotCount[iclass] - count;
+	slot = tcache.slots[iclass];
+	if (keep == 0)
+		tcache.slots[iclass] = NULL;
+	else {
+		while (--keep > 0)
+			slot = *(void **)slot;
+		next = *(void **)slot;
+		*(void **)slot = NULL;
+		slot = next;
+	}
+	tcache.slotCount[iclass] -= count;
+
+	/* Free each run of slots of this thread's arena under one lock, push the others */
+	while (slot != NULL) {
+		arena = findSlab(slot)->arena;
+		last = slot;
+		while ((next = *(void **)last) != NULL && findSlab(next)->arena == arena)
+			last = next;
+		*(void **)last = NULL;
+
+		if (arena == threadArena) {
+			pthread_mutex_lock(&arena->lock);
+			while (slot != NULL) {
+				last = *(void **)slot;
+				freeSlot(arena, slot);
+				slot = last;
+			}
+			pthread_mutex_unlock(&arena->lock);
+		}
+		else {
+			pushRemoteSlots(arena, slot, last);
+			drainIdleArena(arena);
+		}
+
+		slot = next;
+	}
+}
+
+void flushTCacheBins()
+
+/* Returns every chunk and slot of this thread's cache to the shared bins and slabs */
+
+{
+	int units, iclass;
+
+	for (units = 0; units <= TCACHE_MAX_UNITS; units++)
+		if (tcache.count[units] != 0)
+			flushTCacheBin(units, tcache.count[units]);
+	for (iclass = 0; iclass < NUM_SLAB_CLASSES; iclass++)
+		if (tcache.slotCount[iclass] != 0)
+			flushTCacheSlots(iclass, tcache.slotCount[iclass]);
+}
+
+void flushTCache(void *arg)
+
+/* Thread exit destructor : empties this thread's cache, then folds its statistics into
+	the totals and releases its trace buffer */
+
+{
+	(void)arg;
+	flushTCacheBins();
+
+	/* The thread may be the last of its arena, which nobody would drain again */
+	if (threadArena != NULL)
+		drainIdleArena(threadArena);
+
+	/* Keep the thread's statistics in the totals. Should a later destructor allocate,
+		the cache registers again and is flushed again. An unregistered cache is not in
+		threadStatsList, and unlinking it would drop the other threads' statistics */
+	if (tcache.registered) {
+		pthread_mutex_lock(&statsLock);
+		exitedStats.mallocs += tcache.stats.mallocs;
+		exitedStats.frees += tcache.stats.frees;
+		exitedStats.reallocs += tcache.stats.reallocs;
+		exitedStats.allocated += tcache.stats.allocated;
+		exitedStats.freed += tcache.stats.freed;
+		exitedStats.requested += tcache.stats.requested;
+		if (tcache.stats.prev != NULL)
+			tcache.stats.prev->next = tcache.stats.next;
+		else
+			threadStatsList = tcache.stats.next;
+		if (tcache.stats.next != NULL)
+			tcache.stats.next->prev = tcache.stats.prev;
+		pthread_mutex_unlock(&statsLock);
+
+		memset(&tcache.stats, 0, sizeof(tcache.stats));
+		tcache.registered = 0;
+	}
+
+	if (tcache.traceRing != NULL) {
+		releaseTraceRing(tcache.traceRing);
+		tcache.traceRing = NULL;
+	}
+}
+
+void createTCacheKey()
+
+/* Creates the key whose destructor flushes a thread's cache when the thread exits */
+
+{
+	pthread_key_create(&tcacheKey, flushTCache);
+}
+
+void registerTCache()
+
+/* Makes sure this thread's cache is flushed when the thread exits, and that its
+	statistics are counted by my_heap_stats */
+
+{
+	if (!tcache.registered) {
+		/* Registered first : pthread_setspecific may allocate, and so come back here */
+		tcache.registered = 1;
+		pthread_once(&tcacheKeyOnce, createTCacheKey);
+		pthread_setspecific(tcacheKey, &tcache);
+
+		pthread_mutex_lock(&statsLock);
+		tcache.stats.prev = NULL;
+		tcache.stats.next = threadStatsList;
+		if (threadStatsList != NULL)
+			threadStatsList->prev = &tcache.stats;
+		threadStatsList = &tcache.stats;
+		pthread_mutex_unlock(&statsLock);
+	}
+}
+
+void pushTCache(Chunk_T chunk_ptr)
+
+/* Caches an in use chunk in this thread's cache. The chunk keeps its in use status
+	so that its neighbours never coalesce with it */
+
+{
+	int units = (int)Chunk_getUnits(chunk_ptr);
+
+	registerTCache();
+
+	Chunk_setNextInList(chunk_ptr, tcache.bins[units]);
+	tcache.bins[units] = chunk_ptr;
+	tcache.count[units]++;
+}
+
+Chunk_T refillTCache(size_t Units, int *zeroed)
+
+/* Takes TCACHE_FILL chunks of Units units from this thread's arena under a single lock.
+	Returns the first one to the caller, setting *zeroed like allocChunk, and caches the
+	others. Returns NULL if memory allocation failed */
+
+{
+	Arena_T arena = lockThreadArena();
+	Chunk_T chunk_ptr, extra;
+	int i;
+
+	chunk_ptr = allocChunk(arena, Units, zeroed);
+	for (i = 1; chunk_ptr != NULL && i < TCACHE_FILL; i++) {
+		extra = allocChunk(arena, Units, NULL);
+		if (extra == NULL)
+			break;
+
+		/* A chunk with a leftover too small to split may be too big to cache */
+		if (Chunk_getUnits(extra) > TCACHE_MAX_UNITS) {
+			freeChunk(arena, extra);
+			break;
+		}
+		pushTCache(extra);
+	}
+	pthread_mutex_unlock(&arena->lock);
+
+	if (chunk_ptr == NULL)
+		chunk_ptr = allocFromOtherArena(arena, Units, zeroed);
+
+	return chunk_ptr;
+}
+
+void *takeSlot(size_t size)
+
+/* Takes a slot for a region of size bytes, at most HEAPMGR_SLAB_MAX_SIZE, from this
+	thread's cache, refilling the cache with TCACHE_FILL slots under a single lock when
+	it is empty. Returns NULL if the slab region is full */
+
+{
+	int iclass = (int)((size - 1) / SLAB_ALIGN);
+	void *slot = tcache.slots[iclass], *extra;
+	Arena_T arena;
+	int i;
+
+	if (slot != NULL) {
+		tcache.slots[iclass] = *(void **)slot;
+		tcache.slotCount[iclass]--;
+		return slot;
+	}
+
+	registerTCache();
+	arena = lockThreadArena();
+	slot = allocSlot(arena, iclass);
+	for (i = 1; slot != NULL && i < TCACHE_FILL; i++) {
+		extra = allocSlot(arena, iclass);
+		if (extra == NULL)
+			break;
+		*(void **)extra = tcache.slots[iclass];
+		tcache.slots[iclass] = extra;
+		tcache.slotCount[iclass]++;
+	}
+	pthread_mutex_unlock(&arena->lock);
+
+	return slot;
+}
+
+void cacheSlot(void *slot, int iclass)
+
+/* Caches a freed slot of class iclass in this thread's cache, flushing half of the class
+	when full */
+
+{
+	if (tcache.slotCount[iclass] >= TCACHE_MAX_COUNT)
+		flushTCacheSlots(iclass, tcache.slotCount[iclass] - TCACHE_MAX_COUNT / 2);
+
+	registerTCache();
+	*(void **)slot = tcache.slots[iclass];
+	tcache.slots[iclass] = slot;
+	tcache.slotCount[iclass]++;
+}
+
+void putSlot(void *slot)
+
+/* Caches a freed slot in this thread's cache, its class read from its slab's header */
+
+{
+	cacheSlot(slot, (int)(findSlab(slot)->slotSize / SLAB_ALIGN) - 1);
+}
+
+/* STATISTICS ......................................................................... */
+
+void addStat(size_t *counter, size_t n)
+
+/* Adds n to one of this thread's statistics, readable meanwhile by other threads */
+
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+size_t usableSize(void *region)
+
+/* Returns the number of bytes usable in the region : the whole slot, or the whole chunk
+	but for its header */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+
+	if (isSlot(region))
+		return findSlab(region)->slotSize;
+
+	assert(Chunk_getStatus((Chunk_T)((char *)region - UnitSize)) == CHUNK_INUSE);
+	return (Chunk_getUnits((Chunk_T)((char *)region - UnitSize)) - 1) * UnitSize;
+}
+
+void countAllocs(void **regions, size_t n, size_t size)
+
+/* Counts the allocation of the n regions of size bytes in this thread's statistics */
+
+{
+	size_t bytes = 0, i;
+
+	if (n == 0)
+		return;
+	for (i = 0; i < n; i++)
+		bytes += usableSize(regions[i]);
+
+	registerTCache();
+	addStat(&tcache.stats.mallocs, n);
+	addStat(&tcache.stats.allocated, bytes);
+	addStat(&tcache.stats.requested, n * size);
+}
+
+void countAlloc(void *region, size_t size)
+
+/* Counts the allocation of region of size bytes, unless it failed, in this thread's
+	statistics */
+
+{
+	countAllocs(&region, region != NULL, size);
+}
+
+void countFrees(size_t n, size_t bytes)
+
+/* Counts freeing n regions of bytes usable bytes in all in this thread's statistics */
+
+{
+	registerTCache();
+	addStat(&tcache.stats.frees, n);
+	addStat(&tcache.stats.freed, bytes);
+}
+
+void sumThreadStats(ThreadStats *total)
+
+/* Sums up the statistics of all threads, past and present, in *total */
+
+{
+	ThreadStats *stats;
+
+	pthread_mutex_lock(&statsLock);
+	*total = exitedStats;
+	for (stats = threadStatsList; stats != NULL; stats = stats->next) {
+		total->mallocs += __atomic_load_n(&stats->mallocs, __ATOMIC_RELAXED);
+		total->frees += __atomic_load_n(&stats->frees, __ATOMIC_RELAXED);
+		total->reallocs += __atomic_load_n(&stats->reallocs, __ATOMIC_RELAXED);
+		total->allocated += __atomic_load_n(&stats->allocated, __ATOMIC_RELAXED);
+		total->freed += __atomic_load_n(&stats->freed, __ATOMIC_RELAXED);
+		total->requested += __atomic_load_n(&stats->requested, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&statsLock);
+}
+
+void my_heap_stats(struct HeapMgrStats *psStats)
+
+/* Fills in *psStats. Each arena is read under its lock and the threads' statistics under
+	statsLock, so the figures are only consistent with each other when no other thread is
+	using the heap manager */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	unsigned int i;
+	int iBin;
+	Arena_T arena;
+	ThreadStats total;
+
+	memset(psStats, 0, sizeof(*psStats));
+
+	for (i = 0; i < loadArenaCount(); i++) {
+		arena = arenaList[i];
+		pthread_mutex_lock(&arena->lock);
+		psStats->uiHeapBytes += (size_t)((char *)arena->HeapEnd - (char *)arena->HeapStart);
+		psStats->uiFreeBytes += arena->freeUnits * UnitSize;
+		psStats->ulHeapGrowths += arena->growths;
+		psStats->ulHeapTrims += arena->trims;
+		psStats->ulSplits += arena->splits;
+		psStats->ulCoalesces += arena->coalesces;
+		for (iBin = 0; iBin < NUM_BINS; iBin++)
+			psStats->auiBinChunks[iBin] += arena->binChunks[iBin];
+		pthread_mutex_unlock(&arena->lock);
+	}
+
+	pthread_mutex_lock(&slabLock);
+	/* Neither the slabs of free slab indices nor the discarded slabs hold slots */
+	if (slabCount != 0)
+		psStats->uiSlabBytes = (size_t)(slabCount - INDEX_SLABS - cleanSlabCount) * SLAB_SIZE;
+	pthread_mutex_unlock(&slabLock);
+
+	psStats->uiMappedBytes = __atomic_load_n(&mappedBytes, __ATOMIC_RELAXED);
+
+	sumThreadStats(&total);
+	psStats->ulMallocs = total.mallocs;
+	psStats->ulFrees = total.frees;
+	psStats->ulReallocs = total.reallocs;
+
+	/* A region freed by another thread than the one that allocated it may be counted as
+		freed before it is counted as allocated */
+	psStats->uiInUseBytes = total.allocated > total.freed ? total.allocated - total.freed : 0;
+}
+
+void my_heap_fragmentation(struct HeapMgrFragmentation *psFrag)
+
+/* Fills in *psFrag by walking the heap of every arena from HeapStart to HeapEnd under
+	its lock. Chunks sitting in the threads' caches count as in use */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t bytes;
+	unsigned int i;
+	int bucket;
+	Arena_T arena;
+	Chunk_T Chunk;
+	ThreadStats total;
+
+	memset(psFrag, 0, sizeof(*psFrag));
+
+	for (i = 0; i < loadArenaCount(); i++) {
+		arena = arenaList[i];
+		pthread_mutex_lock(&arena->lock);
+		for (Chunk = arena->HeapStart; Chunk != NULL && Chunk != arena->HeapEnd;
+				Chunk = Chunk_getNextInMem(Chunk, arena->HeapEnd)) {
+			bytes = Chunk_getUnits(Chunk) * UnitSize;
+			if (Chunk_getStatus(Chunk) == CHUNK_FREE) {
+				/* A free chunk spends a header and a footer */
+				psFrag->uiFreeChunks++;
+				psFrag->uiFreeBytes += bytes;
+				psFrag->uiOverheadBytes += 2 * UnitSize;
+				if (bytes > psFrag->uiLargestFree)
+					psFrag->uiLargestFree = bytes;
+				for (bucket = 0; (bytes >> (bucket + 1)) != 0; bucket++)
+					;
+				psFrag->auiFreeHistogram[bucket]++;
+			}
+			else {
+				psFrag->uiInUseChunks++;
+				psFrag->uiInUseBytes += bytes;
+				psFrag->uiOverheadBytes += UnitSize;
+			}
+		}
+		pthread_mutex_unlock(&arena->lock);
+	}
+
+	sumThreadStats(&total);
+	psFrag->uiRequestedBytes = total.requested;
+	psFrag->uiGrantedBytes = total.allocated;
+}
+
+void my_heap_dump(FILE *stream)
+
+/* Writes my_heap_stats and my_heap_fragmentation to stream as one line of JSON, leaving
+	out the empty bins and histogram buckets */
+
+{
+	struct HeapMgrStats sStats;
+	struct HeapMgrFragmentation sFrag;
+	const char *sep;
+	int i;
+
+	my_heap_stats(&sStats);
+	my_heap_fragmentation(&sFrag);
+
+	fprintf(stream, "{\"heap_bytes\":%zu,\"free_bytes\":%zu,\"in_use_bytes\":%zu,"
+		"\"slab_bytes\":%zu,\"mapped_bytes\":%zu,\"heap_growths\":%lu,\"heap_trims\":%lu,"
+		"\"splits\":%lu,\"coalesces\":%lu,\"mallocs\":%lu,\"frees\":%lu,\"reallocs\":%lu,",
+		sStats.uiHeapBytes, sStats.uiFreeBytes, sStats.uiInUseBytes, sStats.uiSlabBytes,
+		sStats.uiMappedBytes, sStats.ulHeapGrowths, sStats.ulHeapTrims, sStats.ulSplits,
+		sStats.ulCoalesces, sStats.ulMallocs, sStats.ulFrees, sStats.ulReallocs);
+
+	fprintf(stream, "\"bins\":{");
+	for (i = 0, sep = ""; i < HEAPMGR_NUM_BINS; i++) {
+		if (sStats.auiBinChunks[i] != 0) {
+			fprintf(stream, "%s\"%d\":%zu", sep, i, sStats.auiBinChunks[i]);
+			sep = ",";
+		}
+	}
+
+	fprintf(stream, "},\"free_chunks\":%zu,\"largest_free_bytes\":%zu,"
+		"\"external_fragmentation\":%.4f,\"free_histogram\":{",
+		sFrag.uiFreeChunks, sFrag.uiLargestFree,
+		sFrag.uiFreeBytes == 0 ? 0.0 : 1.0 - (double)sFrag.uiLargestFree / (double)sFrag.uiFreeBytes);
+	for (i = 0, sep = ""; i < HEAPMGR_HISTOGRAM_BUCKETS; i++) {
+		if (sFrag.auiFreeHistogram[i] != 0) {
+			fprintf(stream, "%s\"%d\":%zu", sep, i, sFrag.auiFreeHistogram[i]);
+			sep = ",";
+		}
+	}
+
+	fprintf(stream, "},\"in_use_chunks\":%zu,\"in_use_chunk_bytes\":%zu,\"overhead_bytes\":%zu,"
+		"\"requested_bytes\":%zu,\"granted_bytes\":%zu,\"internal_fragmentation\":%.4f}\n",
+		sFrag.uiInUseChunks, sFrag.uiInUseBytes, sFrag.uiOverheadBytes,
+		sFrag.uiRequestedBytes, sFrag.uiGrantedBytes,
+		sFrag.uiGrantedBytes == 0 ? 0.0 : 1.0 - (double)sFrag.uiRequestedBytes / (double)sFrag.uiGrantedBytes);
+}
+
+/* .................................................................................. */
+
+Chunk_T getChunk(size_t size, int *zeroed)
+
+/* Takes an in use chunk holding a size bytes region from a mapping, this thread's cache
+	or an arena, and sets *zeroed to whether its payload is known to be zero but for its
+	first ZEROED_UNITS units. Returns NULL if size is zero or if memory allocation failed */
+
+{
+	size_t Units;
+	Arena_T arena;
+	Chunk_T chunk_ptr;
+
+	*zeroed = 0;
+	if (size == 0)
+		return NULL;
+
+	/* Determine the number of units the new chunk should contain */
+	Units = sizeToUnits(size);
+
+	/* Large requests get their own mapping, so freeing them gives the memory back */
+	if (size >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED)) {
+		*zeroed = 1;
+		return mapChunk(Units);
+	}
+
+	/* Small chunks come from this thread's cache without taking the lock */
+	if (Units <= TCACHE_MAX_UNITS) {
+		chunk_ptr = tcache.bins[Units];
+		if (chunk_ptr != NULL) {
+			tcache.bins[Units] = Chunk_getNextInList(chunk_ptr);
+			tcache.count[Units]--;
+		}
+		else
+			chunk_ptr = refillTCache(Units, zeroed);
+	}
+	else {
+		arena = lockThreadArena();
+		chunk_ptr = allocChunk(arena, Units, zeroed);
+		pthread_mutex_unlock(&arena->lock);
+
+		if (chunk_ptr == NULL)
+			chunk_ptr = allocFromOtherArena(arena, Units, zeroed);
+	}
+
+	return chunk_ptr;
+}
+
+void *allocRegion(size_t size)
+
+/* Takes a region of size bytes from a slot or a chunk, without counting it in the
+	statistics. Returns NULL if size is zero or if memory allocation failed */
+
+{
+	Chunk_T chunk_ptr;
+	void *slot;
+	int zeroed;
+
+	/* Small requests fit in a slot, unless the slab region is full */
+	if (size - 1 < HEAPMGR_SLAB_MAX_SIZE) {
+		slot = takeSlot(size);
+		if (slot != NULL)
+			return slot;
+	}
+
+	chunk_ptr = getChunk(size, &zeroed);
+	if (chunk_ptr == NULL)
+		return NULL;
+
+	return (void *)((char *)chunk_ptr + Chunk_getUnitSize());
+}
+
+void *my_malloc(size_t size)
+
+/* Allocate numbytes of memory from the free memory pool and return a pointer to the base of the newly allocated region. 
+	Returns NULL if size is zero or if memory allocation failed */
+
+{
+	void *region = allocRegion(size);
+
+	countAlloc(region, size);
+	if (region != NULL)
+		TRACE(HEAPMGR_TRACE_MALLOC, region, 0, size);
+	return region;
+}
+
+/* ................................................................................ */
+
+void freeRegion(void *region)
+
+/* Returns the non NULL region to its slab or arena, without counting it in the statistics */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	Arena_T arena;
+	Chunk_T chunk_ptr;
+	size_t Units;
+
+	if (isSlot(region)) {
+		putSlot(region);
+		return;
+	}
+
+	chunk_ptr = (Chunk_T)((char*)region - UnitSize);
+	assert(Chunk_getStatus(chunk_ptr) == CHUNK_INUSE);
+	Units = Chunk_getUnits(chunk_ptr);
+
+	if (Chunk_isMapped(chunk_ptr)) {
+		unmapChunk(chunk_ptr);
+		return;
+	}
+
+	/* Small chunks go to this thread's cache, which is flushed in batches when full */
+	if (Units <= TCACHE_MAX_UNITS) {
+		if (tcache.count[Units] >= TCACHE_MAX_COUNT)
+			flushTCacheBin((int)Units, tcache.count[Units] - TCACHE_MAX_COUNT / 2);
+		pushTCache(chunk_ptr);
+		return;
+	}
+
+	/* A chunk of another thread's arena is left for that arena to free */
+	arena = findArena(chunk_ptr);
+	if (arena != threadArena) {
+		pushRemoteFrees(arena, chunk_ptr, chunk_ptr);
+		drainIdleArena(arena);
+		return;
+	}
+
+	pthread_mutex_lock(&arena->lock);
+	drainRemoteFrees(arena);
+	freeChunk(arena, chunk_ptr);
+	pthread_mutex_unlock(&arena->lock);
+}
+
+void my_free(void *region)
+
+/* Free a previously allocated region. Region points to a region allocated by my_malloc().
+	If region is NULL do nothing */
+
+{
+	if (region == NULL)
+		return;
+
+	countFrees(1, usableSize(region));
+	TRACE(HEAPMGR_TRACE_FREE, region, 0, 0);
+	freeRegion(region);
+}
+
+void my_free_sized(void *region, size_t size)
+
+/* Free a region allocated, or last reallocated, with size bytes. A slot's class follows
+	from size without reading its slab's header; debug builds check size against the header.
+	A chunk may hold more units than size asks for, so larger regions go through my_free,
+	which reads the chunk's header. If region is NULL do nothing */
+
+{
+	if (region == NULL)
+		return;
+
+	if (size - 1 < HEAPMGR_SLAB_MAX_SIZE && isSlot(region)) {
+		assert(findSlab(region)->slotSize == ((size - 1) / SLAB_ALIGN + 1) * SLAB_ALIGN);
+		countFrees(1, ((size - 1) / SLAB_ALIGN + 1) * SLAB_ALIGN);
+		TRACE(HEAPMGR_TRACE_FREE, region, 0, 0);
+		cacheSlot(region, (int)((size - 1) / SLAB_ALIGN));
+		return;
+	}
+
+	assert(isSlot(region) || (size != 0 && Chunk_getUnits((Chunk_T)((char *)region
+		- Chunk_getUnitSize())) >= sizeToUnits(size)));
+	my_free(region);
+}
+
+/* .................................................................................. */
+
+size_t my_malloc_usable_size(void *region)
+
+/* Returns the number of bytes usable in region, at least the size it was allocated with :
+	the whole slot, or the whole chunk but for its header. Returns 0 if region is NULL */
+
+{
+	return region == NULL ? 0 : usableSize(region);
+}
+
+void *my_malloc_ex(size_t size, size_t *actual)
+
+/* Allocate like my_malloc and store in *actual the number of bytes usable in the region,
+	as my_malloc_usable_size returns, or 0 if allocation failed */
+
+{
+	void *region = my_malloc(size);
+
+	*actual = my_malloc_usable_size(region);
+	return region;
+}
+
+/* .................................................................................. */
+
+size_t my_heap_trim(void)
+
+/* Give as much free memory as possible back to the operating system and return the number
+	of bytes given back */
+
+{
+	Arena_T arena;
+	Chunk_T top;
+	unsigned int i;
+	size_t released = 0;
+
+	/* The calling thread's cached chunks may free up more space */
+	flushTCacheBins();
+
+	for (i = 0; i < loadArenaCount(); i++) {
+		arena = arenaList[i];
+		pthread_mutex_lock(&arena->lock);
+		drainRemoteFrees(arena);
+
+		/* Shrink the heap if it ends with a free chunk */
+		if (arena->HeapStart != NULL && arena->LastFree) {
+			top = Chunk_getFreeBefore(arena->HeapEnd, arena->HeapStart);
+			removefromList(arena, top);
+			released += trimTop(arena, top, 0);
+			InsertinBin(arena, top);
+		}
+
+		/* Discard the inside of the large free chunks */
+		released += discardFreePages(arena->freebinArray[NUM_BINS - 1]);
+
+		pthread_mutex_unlock(&arena->lock);
+	}
+
+	return released + discardFreeSlabs();
+}
+
+/* .................................................................................. */
 
-		return ptr;
+void clearUnits(void *dest, size_t units)
+
+/* Clears units whole units of payload of a unit aligned region, 64 bytes per iteration
+	with SSE2 aligned stores where available, else with memset */
+
+{
+#ifdef __SSE2__
+	__m128i *d = dest;
+	__m128i zero = _mm_setzero_si128();
+
+	assert(Chunk_getUnitSize() == sizeof(__m128i));
+
+	if ((uintptr_t)dest % sizeof(__m128i) == 0) {
+		for (; units >= 4; units -= 4, d += 4) {
+			_mm_store_si128(d, zero);
+			_mm_store_si128(d + 1, zero);
+			_mm_store_si128(d + 2, zero);
+			_mm_store_si128(d + 3, zero);
+		}
+		for (; units > 0; units--, d++)
+			_mm_store_si128(d, zero);
+		return;
+	}
+#endif
+	memset(dest, 0, units * Chunk_getUnitSize());
+}
+
+void *my_calloc(size_t nitems, size_t size)
+
+/* Allocate the requested memory, initialize it to zero and returns a pointer to the beginning of allocated region.
+	Returns NULL if memory allocation failed or if nitems * size does not fit in a size_t */
+
+{	
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t total_size;
+	Chunk_T chunk_ptr;
+	char *region;
+	size_t footer;
+	int zeroed;
+
+	/* The product must not wrap around */
+	if (size != 0 && nitems > (size_t)-1 / size)
+		return NULL;
+	total_size = nitems * size;
+
+	if (total_size - 1 < HEAPMGR_SLAB_MAX_SIZE) {
+		region = takeSlot(total_size);
+		if (region != NULL) {
+			countAlloc(region, total_size);
+			TRACE(HEAPMGR_TRACE_CALLOC, region, 0, total_size);
+			return memset(region, 0, total_size);
+		}
+	}
+
+	chunk_ptr = getChunk(total_size, &zeroed);
+	if (chunk_ptr == NULL)
+		return NULL;
+	region = (char *)chunk_ptr + UnitSize;
+
+	/* Memory fresh from the operating system is already zero, only the links left in its
+		first units and the footer it had while free need clearing. Any other chunk is
+		cleared whole */
+	if (zeroed) {
+		memset(region, 0, total_size < ZEROED_UNITS * UnitSize ? total_size : ZEROED_UNITS * UnitSize);
+		footer = (Chunk_getUnits(chunk_ptr) - 2) * UnitSize;
+		if (footer < total_size)
+			memset(region + footer, 0, total_size - footer);
+	}
+	else
+		clearUnits(region, (total_size - 1) / UnitSize + 1);
+
+	countAlloc(region, total_size);
+	TRACE(HEAPMGR_TRACE_CALLOC, region, 0, total_size);
+	return region;
+}
+
+/* .................................................................................. */
+
+void splitinUse(Arena_T arena, Chunk_T chunk_ptr, size_t Units)
+
+/* Shrinks the in use chunk to Units units and frees the rest of it.
+	The arena's lock must be held */
+
+{
+	size_t splitchunk_size_units = Chunk_getUnits(chunk_ptr) - Units;
+	Chunk_T splitchunk;
+
+	assert(splitchunk_size_units >= MIN_UNITS_PER_CHUNK);
+
+	Chunk_setUnits(chunk_ptr, Units);
+
+	/* Split the chunk, set size and status of the splitchunk and insert it in freebinArray */
+	splitchunk = Chunk_getNextInMem(chunk_ptr, arena->HeapEnd);
+	Chunk_setStatus(splitchunk, CHUNK_INUSE);
+	Chunk_setUnits(splitchunk, splitchunk_size_units);
+	Chunk_setPrevFree(splitchunk, 0);
+
+	freeChunk(arena, splitchunk);
+}
+
+Chunk_T growinPlace(Arena_T arena, Chunk_T chunk_ptr, size_t Units)
+
+/* Grows the in use chunk to at least Units units without moving it, by absorbing the
+	free chunk that follows it in memory, after extending the heap if the chunk is at its
+	top. The part beyond Units is split back into the bins. Returns chunk_ptr, or NULL if
+	the chunk cannot grow in place. The arena's lock must be held */
+
+{
+	size_t initialsize = Chunk_getUnits(chunk_ptr);
+	Chunk_T NextMem = Chunk_getNextInMem(chunk_ptr, arena->HeapEnd);
+	size_t available = initialsize;
+
+	if (NextMem != NULL && Chunk_getStatus(NextMem) == CHUNK_FREE)
+		available += Chunk_getUnits(NextMem);
+
+	/* At the top of the heap the heap itself can grow; the new memory coalesces with
+		the free chunk after ours, if any */
+	if (available < Units && (NextMem == NULL || Chunk_getNextInMem(NextMem, arena->HeapEnd) == NULL)
+		&& (NextMem == NULL || Chunk_getStatus(NextMem) == CHUNK_FREE)) {
+		if (getmoreMemory(arena, Units - available) == NULL)
+			return NULL;
+		NextMem = Chunk_getNextInMem(chunk_ptr, arena->HeapEnd);
+		available = initialsize + Chunk_getUnits(NextMem);
+	}
+
+	if (available < Units)
+		return NULL;
+
+	/* Absorb the next chunk, then give back what is not needed */
+	removefromList(arena, NextMem);
+	Chunk_setUnits(chunk_ptr, available);
+	setPrevFree(arena, chunk_ptr, 0);
+	if (available - Units >= MIN_UNITS_PER_CHUNK)
+		splitinUse(arena, chunk_ptr, Units);
+
+	CHECK_CHUNK(chunk_ptr);
+	return chunk_ptr;
+}
+
+Chunk_T remapChunk(Chunk_T chunk_ptr, size_t Units)
+
+/* Resizes the mapping of a mapped chunk to hold Units units, letting the kernel move it
+	without copying if it cannot grow where it is. Returns the possibly moved chunk, or
+	NULL if the mapping cannot be resized */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t PageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t old_length, new_length;
+	Chunk_T new_chunk;
+
+	/* Only a chunk at the start of its mapping can be remapped as a whole */
+	if (Chunk_getMapping(chunk_ptr) != (void *)chunk_ptr)
+		return NULL;
+	if (Units > ((size_t)-1 - PageSize) / UnitSize)
+		return NULL;
+
+	old_length = Chunk_getUnits(chunk_ptr) * UnitSize;
+	new_length = (Units * UnitSize + PageSize - 1) & ~(PageSize - 1);
+	if (new_length == old_length)
+		return chunk_ptr;
+
+	new_chunk = mremap(chunk_ptr, old_length, new_length, MREMAP_MAYMOVE);
+	if (new_chunk == MAP_FAILED)
+		return NULL;
+
+	Chunk_setUnits(new_chunk, new_length / UnitSize);
+	Chunk_setMapping(new_chunk, new_chunk);
+	__atomic_fetch_add(&mappedBytes, new_length - old_length, __ATOMIC_RELAXED);
+
+	return new_chunk;
+}
+
+void copyUnits(void *dest, const void *src, size_t units)
+
+/* Copies units whole units of payload between two unit aligned regions, 64 bytes per
+	iteration with SSE2 aligned loads and stores where available, else with memcpy */
+
+{
+#ifdef __SSE2__
+	__m128i *d = dest;
+	const __m128i *s = src;
+	__m128i a, b, c, e;
+
+	assert(Chunk_getUnitSize() == sizeof(__m128i));
+
+	if (((uintptr_t)dest | (uintptr_t)src) % sizeof(__m128i) == 0) {
+		for (; units >= 4; units -= 4, d += 4, s += 4) {
+			a = _mm_load_si128(s);
+			b = _mm_load_si128(s + 1);
+			c = _mm_load_si128(s + 2);
+			e = _mm_load_si128(s + 3);
+			_mm_store_si128(d, a);
+			_mm_store_si128(d + 1, b);
+			_mm_store_si128(d + 2, c);
+			_mm_store_si128(d + 3, e);
+		}
+		for (; units > 0; units--, d++, s++)
+			_mm_store_si128(d, _mm_load_si128(s));
+		return;
+	}
+#endif
+	memcpy(dest, src, units * Chunk_getUnitSize());
+}
+
+/* .................................................................................. */
+
+void *resizeRegion(void *ptr, size_t size)
+
+/* Resizes the non NULL region ptr to size bytes, not zero, in place or by moving it,
+	without counting it in the statistics. Returns the possibly moved region, or NULL if
+	the request fails */
+
+{	
+	Arena_T arena;
+	Chunk_T ptr_header, grown;
+	size_t initialsize;
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t size_units;
+
+	Chunk_T new_ptr;
+
+	/* A slot is kept while the new size is of its class, else moved, so that the class of
+		a slot always follows from the size my_free_sized is given */
+	if (isSlot(ptr)) {
+		initialsize = findSlab(ptr)->slotSize;
+		if (size <= initialsize && size > initialsize - SLAB_ALIGN)
+			return ptr;
+		new_ptr = (Chunk_T)allocRegion(size);
+		if (new_ptr != NULL) {
+			size_units = (size - 1) / UnitSize + 1;
+			copyUnits(new_ptr, ptr, size_units < initialsize / UnitSize ?
+				size_units : initialsize / UnitSize);
+			freeRegion(ptr);
+		}
+		return new_ptr;
+	}
+
+	ptr_header = (Chunk_T)((char *)ptr - UnitSize);
+	initialsize = Chunk_getUnits(ptr_header);
+	size_units = sizeToUnits(size);
+
+	if (Chunk_isMapped(ptr_header)) {
+		/* A mapped chunk is resized by the kernel, keeping it when the new size fits */
+		if (size_units <= initialsize && size_units * UnitSize > initialsize * UnitSize / 2)
+			return ptr;
+		grown = remapChunk(ptr_header, size_units);
+		if (grown != NULL)
+			return (void *)((char *)grown + UnitSize);
 	}
+	else {
+		arena = findArena(ptr_header);
+		pthread_mutex_lock(&arena->lock);
+
+		/* Shrink : split the chunk and return same pointer */
+		if (size_units <= initialsize) {
+			if (initialsize - size_units >= MIN_UNITS_PER_CHUNK)
+				splitinUse(arena, ptr_header, size_units);
+			pthread_mutex_unlock(&arena->lock);
+			return ptr;
+		}
 
-	if (size_units <= initialsize)
-		return ptr;
+		/* Grow : absorb the next chunk or extend the heap */
+		grown = growinPlace(arena, ptr_header, size_units);
+		pthread_mutex_unlock(&arena->lock);
+		if (grown != NULL)
+			return ptr;
+	}
 
-	new_ptr = (Chunk_T)my_malloc(size);
+	/* Move : allocate, copy and free */
+	new_ptr = (Chunk_T)allocRegion(size);
 
-	/* Copying byte by byte to new location */
+	/* Copy the whole old payload, or as much as fits, unit by unit. The new region may
+		be a slot, so it only has room for size bytes rounded up to a unit */
 	if (new_ptr != NULL) {
-		new_ptr = (Chunk_T) strncpy((char *)new_ptr, (char *)ptr, (initialsize - 2) * UnitSize);
-		Chunk_setUnits((Chunk_T)((char *)new_ptr - UnitSize), size_units);
-		Chunk_setStatus((Chunk_T)((char *)new_ptr - UnitSize), CHUNK_INUSE);
+		size_units = (size - 1) / UnitSize + 1;
+		if (size_units < initialsize - 1)
+			initialsize = size_units + 1;
+		copyUnits(new_ptr, ptr, initialsize - 1);
+
+		freeRegion(ptr);
+	}
+
+	return new_ptr;
+}
+
+void *my_realloc(void *ptr, size_t size)
 
+/* Resize the memory block pointed to by ptr that was previously allocated with a call to my_malloc or my_calloc.
+	Returns a pointer to the newly allocated memory, or NULL if the request fails. */
+
+{
+	size_t old_size;
+	void *new_ptr;
+
+	if (ptr == NULL)
+		return my_malloc(size);
+	if (size == 0) {
 		my_free(ptr);
+		return NULL;
+	}
+
+	old_size = usableSize(ptr);
+	new_ptr = resizeRegion(ptr, size);
+	if (new_ptr != NULL) {
+		registerTCache();
+		addStat(&tcache.stats.reallocs, 1);
+		addStat(&tcache.stats.allocated, usableSize(new_ptr));
+		addStat(&tcache.stats.requested, size);
+		addStat(&tcache.stats.freed, old_size);
+		TRACE(HEAPMGR_TRACE_REALLOC, new_ptr, (uintptr_t)ptr, size);
 	}
 
 	return new_ptr;
 }
+
+/* ALIGNED ALLOCATION ................................................................. */
+
+Chunk_T alignChunk(Arena_T arena, Chunk_T chunk_ptr, size_t Units, size_t alignment)
+
+/* Carves out of the in use chunk a chunk of Units units whose payload is aligned on
+	alignment bytes, freeing the slack before and after it. The chunk must have room for
+	Units units past its first aligned payload address that leaves a slack big enough to
+	be a chunk. Returns the aligned chunk. The arena's lock must be held */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	char *payload = (char *)chunk_ptr + UnitSize;
+	char *aligned = (char *)(((uintptr_t)payload + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	Chunk_T aligned_ptr;
+	size_t lead;
+
+	/* The leading slack becomes a free chunk, so it cannot be smaller than one */
+	if (aligned != payload && (size_t)(aligned - payload) < MIN_UNITS_PER_CHUNK * UnitSize)
+		aligned += alignment;
+	lead = (size_t)(aligned - payload) / UnitSize;
+	assert(Chunk_getUnits(chunk_ptr) >= lead + Units);
+
+	if (lead > 0) {
+		aligned_ptr = (Chunk_T)(aligned - UnitSize);
+		Chunk_setStatus(aligned_ptr, CHUNK_INUSE);
+		Chunk_setUnits(aligned_ptr, Chunk_getUnits(chunk_ptr) - lead);
+		Chunk_setPrevFree(aligned_ptr, 0);
+
+		Chunk_setUnits(chunk_ptr, lead);
+		freeChunk(arena, chunk_ptr);
+		chunk_ptr = aligned_ptr;
+	}
+
+	if (Chunk_getUnits(chunk_ptr) - Units >= MIN_UNITS_PER_CHUNK)
+		splitinUse(arena, chunk_ptr, Units);
+
+	CHECK_CHUNK(chunk_ptr);
+	return chunk_ptr;
+}
+
+Chunk_T alignMappedChunk(Chunk_T chunk_ptr, size_t alignment)
+
+/* Moves the header of a chunk at the start of its mapping so that the payload is
+	aligned on alignment bytes. The chunk keeps its mapping, whose head is left unused */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	char *payload = (char *)chunk_ptr + UnitSize;
+	char *aligned = (char *)(((uintptr_t)payload + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	Chunk_T aligned_ptr = (Chunk_T)(aligned - UnitSize);
+
+	if (aligned_ptr == chunk_ptr)
+		return chunk_ptr;
+
+	Chunk_setStatus(aligned_ptr, CHUNK_INUSE);
+	Chunk_setUnits(aligned_ptr, Chunk_getUnits(chunk_ptr) - (size_t)(aligned - payload) / UnitSize);
+	Chunk_setMapping(aligned_ptr, Chunk_getMapping(chunk_ptr));
+
+	return aligned_ptr;
+}
+
+void *my_memalign(size_t alignment, size_t size)
+
+/* Allocate size bytes whose address is a multiple of alignment, a power of two, and return
+	a pointer to the allocated region, which my_free frees like any other.
+	Returns NULL if size is zero, if alignment is not a power of two or if memory allocation failed */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t Units, extra;
+	Arena_T arena;
+	Chunk_T chunk_ptr;
+
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+		return NULL;
+
+	/* Every region is already aligned on a unit */
+	if (alignment <= UnitSize)
+		return my_malloc(size);
+
+	if (size == 0 || size > (size_t)-1 / 4 || alignment > (size_t)-1 / 4)
+		return NULL;
+
+	/* Room for the slack before the first aligned address, which must hold a whole chunk */
+	Units = sizeToUnits(size);
+	extra = alignment / UnitSize + MIN_UNITS_PER_CHUNK;
+
+	if (size >= __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED)) {
+		chunk_ptr = mapChunk(Units + alignment / UnitSize);
+		if (chunk_ptr == NULL)
+			return NULL;
+		chunk_ptr = alignMappedChunk(chunk_ptr, alignment);
+		countAlloc((char *)chunk_ptr + UnitSize, size);
+		TRACE(HEAPMGR_TRACE_MEMALIGN, (char *)chunk_ptr + UnitSize, alignment, size);
+		return (char *)chunk_ptr + UnitSize;
+	}
+
+	arena = lockThreadArena();
+	chunk_ptr = allocChunk(arena, Units + extra, NULL);
+	if (chunk_ptr != NULL)
+		chunk_ptr = alignChunk(arena, chunk_ptr, Units, alignment);
+	pthread_mutex_unlock(&arena->lock);
+
+	if (chunk_ptr == NULL) {
+		chunk_ptr = allocFromOtherArena(arena, Units + extra, NULL);
+		if (chunk_ptr == NULL)
+			return NULL;
+
+		arena = findArena(chunk_ptr);
+		pthread_mutex_lock(&arena->lock);
+		chunk_ptr = alignChunk(arena, chunk_ptr, Units, alignment);
+		pthread_mutex_unlock(&arena->lock);
+	}
+
+	countAlloc((char *)chunk_ptr + UnitSize, size);
+	TRACE(HEAPMGR_TRACE_MEMALIGN, (char *)chunk_ptr + UnitSize, alignment, size);
+	return (char *)chunk_ptr + UnitSize;
+}
+
+void *my_aligned_alloc(size_t alignment, size_t size)
+
+/* C11 aligned_alloc : allocate size bytes aligned on alignment, a power of two.
+	Returns NULL if memory allocation failed */
+
+{
+	return my_memalign(alignment, size);
+}
+
+int my_posix_memalign(void **memptr, size_t alignment, size_t size)
+
+/* POSIX posix_memalign : store in *memptr a region of size bytes aligned on alignment, a
+	power of two multiple of sizeof(void *). Returns 0 on success, EINVAL if alignment is
+	not valid or ENOMEM if memory allocation failed, leaving *memptr unchanged */
+
+{
+	void *region;
+
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0 || alignment == 0)
+		return EINVAL;
+
+	if (size == 0) {
+		*memptr = NULL;
+		return 0;
+	}
+
+	region = my_memalign(alignment, size);
+	if (region == NULL)
+		return ENOMEM;
+
+	*memptr = region;
+	return 0;
+}
+
+/* BATCHES ............................................................................ */
+
+size_t my_malloc_batch(size_t size, size_t n, void **out)
+
+/* Allocate n regions of size bytes, storing pointers to them in out[0] to out[n - 1].
+	Slots are taken under a single lock, and the chunks of a heap request are carved
+	out of one chunk taken from the bins at once. Returns the number of regions
+	allocated, less than n only if memory allocation failed */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t Units, i = 0, j;
+	int iclass;
+	Arena_T arena;
+	Chunk_T chunk_ptr, next;
+
+	if (size == 0 || n == 0)
+		return 0;
+
+	if (size - 1 < HEAPMGR_SLAB_MAX_SIZE) {
+		/* The cached slots first, then the rest from the slabs under one lock */
+		iclass = (int)((size - 1) / SLAB_ALIGN);
+		for (; i < n && tcache.slots[iclass] != NULL; i++) {
+			out[i] = tcache.slots[iclass];
+			tcache.slots[iclass] = *(void **)out[i];
+			tcache.slotCount[iclass]--;
+		}
+		if (i < n) {
+			arena = lockThreadArena();
+			for (; i < n && (out[i] = allocSlot(arena, iclass)) != NULL; i++)
+				;
+			pthread_mutex_unlock(&arena->lock);
+		}
+	}
+	else if (size < __atomic_load_n(&mmapThreshold, __ATOMIC_RELAXED)) {
+		Units = sizeToUnits(size);
+		if (n <= ((size_t)-1 / UnitSize) / Units) {
+			arena = lockThreadArena();
+			chunk_ptr = allocChunk(arena, n * Units, NULL);
+			if (chunk_ptr != NULL) {
+				/* Every chunk follows an in use one. The last takes any leftover */
+				for (; i < n - 1; i++) {
+					next = (Chunk_T)((char *)chunk_ptr + Units * UnitSize);
+					Chunk_setStatus(next, CHUNK_INUSE);
+					Chunk_setUnits(next, Chunk_getUnits(chunk_ptr) - Units);
+					Chunk_setPrevFree(next, 0);
+					Chunk_setUnits(chunk_ptr, Units);
+					out[i] = (char *)chunk_ptr + UnitSize;
+					chunk_ptr = next;
+				}
+				out[i++] = (char *)chunk_ptr + UnitSize;
+			}
+			pthread_mutex_unlock(&arena->lock);
+		}
+	}
+
+	countAllocs(out, i, size);
+	for (j = 0; j < i; j++)
+		TRACE(HEAPMGR_TRACE_MALLOC, out[j], 0, size);
+
+	/* What could not be served in bulk is allocated one region at a time */
+	for (; i < n && (out[i] = my_malloc(size)) != NULL; i++)
+		;
+
+	return i;
+}
+
+int compareAddresses(const void *a, const void *b)
+
+/* qsort comparison of two region pointers by address */
+
+{
+	uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+
+	return (x > y) - (x < y);
+}
+
+void my_free_batch(void **ptrs, size_t n)
+
+/* Free the n regions ptrs[0] to ptrs[n - 1], any of which may be NULL. Small chunks go to
+	this thread's cache while it has room. The other regions of the heaps are moved to the
+	front of ptrs and sorted by address : those of this thread's arena that are adjacent in
+	memory merge into one chunk freed once, under a single lock, and those of another
+	arena are pushed on its remote free stack at once */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	Arena_T remoteArena = NULL, owner;
+	Chunk_T run = NULL, remote = NULL, last = NULL, chunk_ptr;
+	size_t i, Units, heap = 0, count = 0, bytes = 0;
+
+	/* Slots, mappings and cached chunks need no sorting */
+	for (i = 0; i < n; i++) {
+		if (ptrs[i] == NULL)
+			continue;
+		count++;
+		bytes += usableSize(ptrs[i]);
+		TRACE(HEAPMGR_TRACE_FREE, ptrs[i], 0, 0);
+		if (isSlot(ptrs[i])) {
+			putSlot(ptrs[i]);
+			continue;
+		}
+
+		chunk_ptr = (Chunk_T)((char *)ptrs[i] - UnitSize);
+		assert(Chunk_getStatus(chunk_ptr) == CHUNK_INUSE);
+		Units = Chunk_getUnits(chunk_ptr);
+		if (Chunk_isMapped(chunk_ptr))
+			unmapChunk(chunk_ptr);
+		else if (Units <= TCACHE_MAX_UNITS && tcache.count[Units] < TCACHE_MAX_COUNT)
+			pushTCache(chunk_ptr);
+		else
+			ptrs[heap++] = ptrs[i];
+	}
+	if (count != 0)
+		countFrees(count, bytes);
+
+	qsort(ptrs, heap, sizeof(void *), compareAddresses);
+
+	for (i = 0; i < heap; i++) {
+		chunk_ptr = (Chunk_T)((char *)ptrs[i] - UnitSize);
+		owner = findArena(chunk_ptr);
+
+		/* A chunk of another thread's arena is left for that arena to free. Its headers
+			are read by that arena's thread, so it is not merged : the chunks of each arena,
+			kept together by the sort, are linked and pushed once */
+		if (owner != threadArena) {
+			if (remote != NULL && owner != remoteArena) {
+				pushRemoteFrees(remoteArena, remote, last);
+				drainIdleArena(remoteArena);
+				remote = NULL;
+			}
+			if (remote == NULL) {
+				remote = chunk_ptr;
+				remoteArena = owner;
+			}
+			else
+				Chunk_setNextInList(last, chunk_ptr);
+			last = chunk_ptr;
+			continue;
+		}
+
+		/* Extend the run of in use chunks while they follow each other */
+		if (run != NULL && (char *)run + Chunk_getUnits(run) * UnitSize == (char *)chunk_ptr) {
+			Chunk_setUnits(run, Chunk_getUnits(run) + Chunk_getUnits(chunk_ptr));
+			continue;
+		}
+		if (run != NULL)
+			freeChunk(threadArena, run);
+		else {
+			pthread_mutex_lock(&threadArena->lock);
+			drainRemoteFrees(threadArena);
+		}
+		run = chunk_ptr;
+	}
+
+	if (run != NULL) {
+		freeChunk(threadArena, run);
+		pthread_mutex_unlock(&threadArena->lock);
+	}
+	if (remote != NULL) {
+		pushRemoteFrees(remoteArena, remote, last);
+		drainIdleArena(remoteArena);
+	}
+}
+
+/* HEAP HANDLES ....................................................................... */
+
+HeapMgr_T HeapMgr_default(void)
+
+/* Returns the main arena, which stands for the whole heap of the my_* functions : its
+	arenas, slabs, thread caches and mappings */
+
+{
+	return &mainArena;
+}
+
+HeapMgr_T HeapMgr_create(void *pvRegion, size_t uiSize)
+
+/* Sets up an arena at the start of the region, aligned on a unit, with an empty heap right
+	after it that grows up to the region's end as it is used. Only the arena is written, so
+	this takes constant time. Returns NULL if the region cannot hold the arena and a chunk */
+
+{
+	size_t UnitSize = Chunk_getUnitSize();
+	size_t ArenaUnits = (sizeof(Arena) - 1) / UnitSize + 1;
+	char *start, *end;
+	Arena_T arena;
+
+	if (pvRegion == NULL || uiSize > UINTPTR_MAX - (uintptr_t)pvRegion)
+		return NULL;
+
+	start = (char *)(((uintptr_t)pvRegion + UnitSize - 1) & ~(uintptr_t)(UnitSize - 1));
+	end = (char *)(((uintptr_t)pvRegion + uiSize) & ~(uintptr_t)(UnitSize - 1));
+	if (end < start || (size_t)(end - start) / UnitSize < ArenaUnits + MIN_UNITS_PER_CHUNK)
+		return NULL;
+
+	arena = (Arena_T)start;
+	memset(arena, 0, sizeof(Arena));
+	pthread_mutex_init(&arena->lock, NULL);
+	arena->HeapStart = (Chunk_T)(start + ArenaUnits * UnitSize);
+	arena->HeapEnd = arena->HeapStart;
+	arena->RegionEnd = (Chunk_T)end;
+	arena->External = 1;
+
+	return arena;
+}
+
+void *HeapMgr_malloc(HeapMgr_T oHeap, size_t uiSize)
+
+/* Takes a chunk from the arena's bins or the rest of its region, with none of the slabs,
+	thread caches and mappings of the default heap, which would mix the heaps */
+
+{
+	Arena_T arena = oHeap;
+	Chunk_T chunk_ptr;
+
+	if (arena == &mainArena)
+		return my_malloc(uiSize);
+
+	if (uiSize == 0 || uiSize > (size_t)((char *)arena->RegionEnd - (char *)arena->HeapStart))
+		return NULL;
+
+	pthread_mutex_lock(&arena->lock);
+	chunk_ptr = allocChunk(arena, sizeToUnits(uiSize), NULL);
+	pthread_mutex_unlock(&arena->lock);
+
+	if (chunk_ptr == NULL)
+		return NULL;
+
+	return (void *)((char *)chunk_ptr + Chunk_getUnitSize());
+}
+
+void HeapMgr_free(HeapMgr_T oHeap, void *pvRegion)
+
+/* Returns the region's chunk to the arena's bins */
+
+{
+	Arena_T arena = oHeap;
+	Chunk_T chunk_ptr;
+
+	if (pvRegion == NULL)
+		return;
+
+	if (arena == &mainArena) {
+		my_free(pvRegion);
+		return;
+	}
+
+	chunk_ptr = (Chunk_T)((char *)pvRegion - Chunk_getUnitSize());
+
+	pthread_mutex_lock(&arena->lock);
+	assert(chunk_ptr >= arena->HeapStart && chunk_ptr < arena->HeapEnd);
+	assert(Chunk_getStatus(chunk_ptr) == CHUNK_INUSE);
+	freeChunk(arena, chunk_ptr);
+	pthread_mutex_unlock(&arena->lock);
+}
+
+void HeapMgr_destroy(HeapMgr_T oHeap)
+
+/* Nothing but the arena refers to the caller's region, so dropping it frees everything */
+
+{
+	if (oHeap == &mainArena)
+		return;
+
+	pthread_mutex_destroy(&oHeap->lock);
+}
@@ -15,7 +15,16 @@
 *    along with project.  If not, see <http://www.gnu.org/licenses/>.
 *****************************************************************************/
 
+#ifndef HEAPMNGR_INCLUDED
+#define HEAPMNGR_INCLUDED
+
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 void *my_malloc(size_t numbytes);
 /* Allocate numbytes of memory from the free memory pool and return a pointer to the base of the newly allocated region. 
@@ -25,10 +34,254 @@ void my_free(void *region);
 /* Free a previously allocated region. Region points to a region allocated by my_malloc().
 	If region is NULL do nothing */
 
+void my_free_sized(void *region, size_t size);
+/* Free a region like my_free, given the size it was allocated, or last reallocated, with.
+	Regions served from slabs, of up to 256 bytes by default, are freed without reading
+	their header. For larger regions size is only checked in debug builds : a chunk may be
+	larger than the size it was asked for, so its header is read as my_free does.
+	If region is NULL do nothing */
+
+size_t my_malloc_usable_size(void *region);
+/* Return the number of bytes usable in a region allocated by my_malloc() or any of the
+	functions below, at least the size it was allocated with. Writing up to that many bytes
+	is allowed. Return 0 if region is NULL */
+
+void *my_malloc_ex(size_t size, size_t *actual);
+/* Allocate like my_malloc() and store in *actual the number of bytes usable in the region,
+	or 0 if allocation failed */
+
 void *my_realloc(void *ptr, size_t size);
 /* Resize the memory block pointed to by ptr that was previously allocated with a call to my_malloc or my_calloc.
 	Returns a pointer to the newly allocated memory, or NULL if the request fails. */
 
 void *my_calloc(size_t nitems, size_t size);
 /* Allocate the requested memory, initialize it to zero and returns a pointer to the beginning of allocated region.
-	Returns NULL if memory allocation failed */
\ No newline at end of file
+	Returns NULL if memory allocation failed or if nitems * size does not fit in a size_t */
+
+void *my_memalign(size_t alignment, size_t size);
+/* Allocate size bytes whose address is a multiple of alignment, a power of two, and return
+	a pointer to the allocated region, which my_free frees like any other.
+	Returns NULL if size is zero, if alignment is not a power of two or if memory allocation failed */
+
+void *my_aligned_alloc(size_t alignment, size_t size);
+/* C11 aligned_alloc : allocate size bytes aligned on alignment, a power of two.
+	Returns NULL if memory allocation failed */
+
+int my_posix_memalign(void **memptr, size_t alignment, size_t size);
+/* POSIX posix_memalign : store in *memptr a region of size bytes aligned on alignment, a
+	power of two multiple of sizeof(void *). Returns 0 on success, EINVAL if alignment is
+	not valid or ENOMEM if memory allocation failed, leaving *memptr unchanged */
+
+size_t my_malloc_batch(size_t size, size_t n, void **out);
+/* Allocate n regions of size bytes, storing pointers to them in out[0] to out[n - 1], with
+	the bookkeeping of a single allocation. Returns the number of regions allocated,
+	less than n only if memory allocation failed */
+
+void my_free_batch(void **ptrs, size_t n);
+/* Free the n regions ptrs[0] to ptrs[n - 1], any of which may be NULL, coalescing the
+	regions adjacent in memory once. ptrs is reordered in place */
+
+size_t my_heap_trim(void);
+/* Give free memory back to the operating system : shrink every heap that ends with a free
+	chunk and discard the whole pages inside large free chunks. Returns the number of bytes
+	given back */
+
+#define HEAPMGR_NUM_BINS 1024
+/* The number of bins of free chunks : bin i holds the chunks of i units of 16 bytes, the
+	last one those of HEAPMGR_NUM_BINS - 1 units or more */
+
+struct HeapMgrStats {
+	size_t uiHeapBytes;
+	/* Bytes of the heaps of all arenas */
+
+	size_t uiFreeBytes;
+	/* Bytes of the free chunks in the bins of all arenas */
+
+	size_t uiInUseBytes;
+	/* Usable bytes, as my_malloc_usable_size() counts them, of the regions allocated and
+		not freed yet */
+
+	size_t uiSlabBytes;
+	/* Bytes of the slabs small regions are served from, not counting those given back
+		to the operating system */
+
+	size_t uiMappedBytes;
+	/* Bytes of the regions with their own memory mapping */
+
+	unsigned long ulHeapGrowths;
+	unsigned long ulHeapTrims;
+	/* How many times a heap grew, with brk or into its arena's region, and shrank */
+
+	unsigned long ulSplits;
+	unsigned long ulCoalesces;
+	/* How many times a free chunk was split to serve a request, and two free chunks were
+		coalesced */
+
+	unsigned long ulMallocs;
+	unsigned long ulFrees;
+	unsigned long ulReallocs;
+	/* The number of regions allocated, by any allocation function, freed and resized */
+
+	size_t auiBinChunks[HEAPMGR_NUM_BINS];
+	/* The number of free chunks in each bin of all arenas */
+};
+
+void my_heap_stats(struct HeapMgrStats *psStats);
+/* Fill in *psStats. The counters are kept per thread and per arena as the heap manager
+	runs and only summed up here, so polling them is cheap. The figures are exact when no
+	other thread is using the heap manager, and close to it otherwise */
+
+#define HEAPMGR_HISTOGRAM_BUCKETS 64
+/* The number of buckets of the histogram of free chunk sizes : bucket i counts the free
+	chunks of 2^i to 2^(i + 1) - 1 bytes */
+
+struct HeapMgrFragmentation {
+	size_t uiFreeChunks;
+	size_t uiFreeBytes;
+	/* The number and bytes of the free chunks of all heaps */
+
+	size_t uiLargestFree;
+	/* Bytes of the largest free chunk. External fragmentation is 1 - uiLargestFree /
+		uiFreeBytes : the share of free memory a single request cannot use */
+
+	size_t auiFreeHistogram[HEAPMGR_HISTOGRAM_BUCKETS];
+	/* The number of free chunks of each size class, by powers of two */
+
+	size_t uiInUseChunks;
+	size_t uiInUseBytes;
+	/* The number and bytes, headers included, of the in use chunks of all heaps */
+
+	size_t uiOverheadBytes;
+	/* Bytes of the headers of all chunks and of the footers of the free ones */
+
+	size_t uiRequestedBytes;
+	size_t uiGrantedBytes;
+	/* Bytes asked for and usable bytes handed out by every allocation so far. Internal
+		fragmentation is 1 - uiRequestedBytes / uiGrantedBytes */
+};
+
+void my_heap_fragmentation(struct HeapMgrFragmentation *psFrag);
+/* Fill in *psFrag by walking every heap, which takes time linear in the number of chunks.
+	Regions served from slabs or their own mapping are not part of the heaps */
+
+void my_heap_dump(FILE *stream);
+/* Write my_heap_stats() and my_heap_fragmentation() to stream as one line of JSON */
+
+enum HeapMgrTraceOp {HEAPMGR_TRACE_MALLOC, HEAPMGR_TRACE_CALLOC, HEAPMGR_TRACE_REALLOC,
+	HEAPMGR_TRACE_MEMALIGN, HEAPMGR_TRACE_FREE};
+/* The events of a trace. my_aligned_alloc and my_posix_memalign are traced as
+	HEAPMGR_TRACE_MEMALIGN, the batch functions as one event per region, and any call
+	made with a NULL region or a zero size as the my_malloc or my_free call it amounts to */
+
+#define HEAPMGR_TRACE_MAGIC		"HMTRACE1"
+#define HEAPMGR_TRACE_OP_SHIFT	56
+#define HEAPMGR_TRACE_TIME_MASK	(((uint64_t)1 << HEAPMGR_TRACE_OP_SHIFT) - 1)
+
+struct HeapMgrTraceRecord {
+	uint64_t ulOpTime;
+	/* The event's HeapMgrTraceOp << HEAPMGR_TRACE_OP_SHIFT, or'ed with the nanoseconds
+		since the trace started */
+
+	uint64_t ulId;
+	/* The address of the region allocated or freed, the new one for a realloc */
+
+	uint64_t ulAux;
+	/* The address of the old region for a realloc, the alignment for a memalign, else 0 */
+
+	uint64_t ulSize;
+	/* The size asked for, the total for a calloc, 0 for a free */
+};
+
+struct HeapMgrTraceBlock {
+	uint32_t uiThread;
+	uint32_t uiCount;
+};
+/* A trace file is HEAPMGR_TRACE_MAGIC followed by blocks, each this header followed by
+	uiCount records of the thread numbered uiThread in time order. The blocks of different
+	threads interleave, so the events are in order once sorted by time. Only successful
+	calls are recorded */
+
+int HeapMgr_startTrace(const char *pcPath);
+/* Record every allocation and free to the trace file pcPath, created or truncated, until
+	HeapMgr_stopTrace(). Each thread buffers its records, so tracing costs a few tens of
+	nanoseconds per call. Setting the environment variable HEAPMGR_TRACE to a path traces
+	the whole run of a program. Return 0 on success, or -1 with errno set if a trace is
+	already running or the file cannot be created */
+
+void HeapMgr_stopTrace(void);
+/* Stop tracing, write out the records buffered by every thread and close the trace file */
+
+#ifndef HEAPMGR_TRIM_THRESHOLD
+#define HEAPMGR_TRIM_THRESHOLD	((size_t)128 << 10)
+#endif
+/* The default trim threshold, which may be set when compiling heapmngr.c */
+
+void HeapMgr_setTrimThreshold(size_t uiBytes);
+/* Make my_free shrink a heap once its last free chunk reaches uiBytes.
+	The default is HEAPMGR_TRIM_THRESHOLD */
+
+#ifndef HEAPMGR_MAX_ARENAS
+#define HEAPMGR_MAX_ARENAS	64
+#endif
+/* The most arenas there can be, which may be set when compiling heapmngr.c */
+
+void HeapMgr_setArenaCount(unsigned int uiCount);
+/* Spread the threads that have not allocated yet over uiCount independent arenas, each with
+	its own heap and lock (at most HEAPMGR_MAX_ARENAS). The default is one arena per
+	online processor */
+
+#ifndef HEAPMGR_MMAP_THRESHOLD
+#define HEAPMGR_MMAP_THRESHOLD	((size_t)128 << 10)
+#endif
+/* The default mapping threshold, which may be set when compiling heapmngr.c */
+
+void HeapMgr_setMmapThreshold(size_t uiBytes);
+/* Serve requests of uiBytes or more from their own memory mapping, which my_free unmaps
+	at once, instead of from the heap. The default is HEAPMGR_MMAP_THRESHOLD */
+
+enum HeapMgrCheckLevel {HEAPMGR_CHECK_OFF, HEAPMGR_CHECK_CHEAP, HEAPMGR_CHECK_PERIODIC, HEAPMGR_CHECK_FULL};
+/* How much consistency checking the heap manager does on each call : none, O(1) checks of
+	the chunks being touched, a full heap check every few calls on top of those, or a full
+	heap check on every call. Checking is compiled out entirely when NDEBUG is defined */
+
+void HeapMgr_setCheckLevel(enum HeapMgrCheckLevel eLevel, unsigned long uiInterval);
+/* Set the check level to eLevel. At HEAPMGR_CHECK_PERIODIC the whole heap is checked every
+	uiInterval checks; an uiInterval of 0 keeps the current interval */
+
+int HeapMgr_isValid(void);
+/* Walk the heap and bins of every arena and return 1 (TRUE) if the heap manager is in a valid
+	state, or 0 (FALSE) otherwise, reporting the first problem on stderr. Usable on demand
+	at any check level */
+
+typedef struct HeapMgr *HeapMgr_T;
+/* A heap. HeapMgr_default() is the one the my_* functions allocate from; HeapMgr_create()
+	makes others, each isolated in a region of the caller's memory */
+
+HeapMgr_T HeapMgr_default(void);
+/* Return the process wide heap of my_malloc and my_free, which cannot be destroyed */
+
+HeapMgr_T HeapMgr_create(void *pvRegion, size_t uiSize);
+/* Make a heap of the uiSize bytes at pvRegion, which hold its bookkeeping followed by its
+	chunks and must stay untouched until HeapMgr_destroy(). The heap has its own bins and
+	lock, and never shares memory with the default heap or another one. The bookkeeping
+	takes about 17 KB. Returns NULL if pvRegion is NULL or uiSize is too small for the
+	bookkeeping and a chunk */
+
+void *HeapMgr_malloc(HeapMgr_T oHeap, size_t uiSize);
+/* Allocate uiSize bytes from oHeap, aligned on 16 bytes. Returns NULL if uiSize is zero or
+	if oHeap has no free chunk that large */
+
+void HeapMgr_free(HeapMgr_T oHeap, void *pvRegion);
+/* Free pvRegion, allocated by HeapMgr_malloc from oHeap. If pvRegion is NULL do nothing.
+	Regions of a created heap must not be passed to my_free, nor those of my_malloc to a
+	created heap */
+
+void HeapMgr_destroy(HeapMgr_T oHeap);
+/* Destroy oHeap in constant time, every region allocated from it at once, and give its
+	region back to the caller. Destroying the default heap does nothing */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
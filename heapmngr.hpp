@@ -0,0 +1,143 @@
+/*****************************************************************************
+*    This file is part of project.
+*
+*    project is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    project is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with project.  If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/* C++17 adapters of the heap manager : a std::pmr::memory_resource for the
+   std::pmr containers and an allocator for the other standard containers.
+   Both free with my_free_sized, since the containers know the size of what
+   they give back, and over-aligned requests go to my_aligned_alloc. */
+
+#ifndef HEAPMNGR_HPP_INCLUDED
+#define HEAPMNGR_HPP_INCLUDED
+
+#include "heapmngr.h"
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+/* The alignment my_malloc gives every region */
+#define HEAPMGR_ALIGNMENT 16
+
+/*--------------------------------------------------------------------*/
+
+inline void *HeapMgr_allocate(std::size_t uiBytes, std::size_t uiAlignment)
+
+/* Allocate uiBytes aligned on uiAlignment, a power of two, a zero size
+   getting the smallest region. Throws std::bad_alloc on failure. */
+
+{
+   void *pvRegion;
+
+   if (uiBytes == 0)
+      uiBytes = 1;
+   if (uiAlignment <= HEAPMGR_ALIGNMENT)
+      pvRegion = my_malloc(uiBytes);
+   else
+      pvRegion = my_aligned_alloc(uiAlignment, uiBytes);
+   if (pvRegion == nullptr)
+      throw std::bad_alloc();
+   return pvRegion;
+}
+
+/*--------------------------------------------------------------------*/
+
+inline void HeapMgr_deallocate(void *pvRegion, std::size_t uiBytes)
+
+/* Free pvRegion, allocated by HeapMgr_allocate with uiBytes. */
+
+{
+   my_free_sized(pvRegion, uiBytes == 0 ? 1 : uiBytes);
+}
+
+/*--------------------------------------------------------------------*/
+
+/* A memory resource on the heap manager. Every instance shares the one
+   heap, so any instance frees what another allocated. */
+class HeapMgrResource : public std::pmr::memory_resource {
+protected:
+   void *do_allocate(std::size_t uiBytes, std::size_t uiAlignment) override
+   {
+      return HeapMgr_allocate(uiBytes, uiAlignment);
+   }
+
+   void do_deallocate(void *pvRegion, std::size_t uiBytes, std::size_t) override
+   {
+      HeapMgr_deallocate(pvRegion, uiBytes);
+   }
+
+   bool do_is_equal(const std::pmr::memory_resource &oOther) const noexcept override
+   {
+      return dynamic_cast<const HeapMgrResource *>(&oOther) != nullptr;
+   }
+};
+
+/*--------------------------------------------------------------------*/
+
+inline HeapMgrResource *HeapMgr_resource()
+
+/* Return a resource that lives as long as the program, to hand to the
+   std::pmr containers or to std::pmr::set_default_resource. */
+
+{
+   static HeapMgrResource oResource;
+
+   return &oResource;
+}
+
+/*--------------------------------------------------------------------*/
+
+/* A standard allocator of T on the heap manager. It has no state : any
+   two allocators are equal. */
+template <class T>
+class HeapMgrAllocator {
+public:
+   typedef T value_type;
+   typedef std::true_type is_always_equal;
+   typedef std::true_type propagate_on_container_move_assignment;
+
+   HeapMgrAllocator() noexcept = default;
+
+   template <class U>
+   HeapMgrAllocator(const HeapMgrAllocator<U> &) noexcept {}
+
+   T *allocate(std::size_t uiCount)
+   {
+      if (uiCount > std::numeric_limits<std::size_t>::max() / sizeof(T))
+         throw std::bad_array_new_length();
+      return static_cast<T *>(HeapMgr_allocate(uiCount * sizeof(T), alignof(T)));
+   }
+
+   void deallocate(T *pObjects, std::size_t uiCount) noexcept
+   {
+      HeapMgr_deallocate(pObjects, uiCount * sizeof(T));
+   }
+};
+
+template <class T, class U>
+inline bool operator==(const HeapMgrAllocator<T> &, const HeapMgrAllocator<U> &) noexcept
+{
+   return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const HeapMgrAllocator<T> &, const HeapMgrAllocator<U> &) noexcept
+{
+   return false;
+}
+
+#endif
@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
 
 /* The maximum allowable number of calls of HeapMgr_malloc(). */
 #define MAX_CALLS      10000
@@ -176,6 +178,158 @@ void realloc_test()
 
 /*--------------------------------------------------------------------*/
 
+/* Number of live chunks each thread of the throughput test keeps. */
+#define THREAD_SLOTS   256
+
+static int iThreadOps;
+
+static void *throughputWorker(void *arg)
+
+/* Allocate and free iThreadOps chunks of random small sizes, keeping up to
+   THREAD_SLOTS of them alive. */
+
+{
+   char *apcSlots[THREAD_SLOTS] = {NULL};
+   unsigned int uiSeed = (unsigned int)(size_t)arg;
+   int i, iSlot;
+
+   for (i = 0; i < iThreadOps; i++) {
+      iSlot = rand_r(&uiSeed) % THREAD_SLOTS;
+      if (apcSlots[iSlot] != NULL) {
+         my_free(apcSlots[iSlot]);
+         apcSlots[iSlot] = NULL;
+      }
+      else {
+         apcSlots[iSlot] = (char *)my_malloc((size_t)(rand_r(&uiSeed) % 512) + 1);
+         assert(apcSlots[iSlot] != NULL);
+         apcSlots[iSlot][0] = 'x';
+      }
+   }
+
+   for (iSlot = 0; iSlot < THREAD_SLOTS; iSlot++)
+      my_free(apcSlots[iSlot]);
+   return NULL;
+}
+
+void testThroughput(int iMaxThreads, int iOps)
+
+/* Run iOps random my_malloc() and my_free() calls in each of 1, 2, 4, ...
+   iMaxThreads threads, one arena per thread, and print the throughput. */
+
+{
+   pthread_t aThreads[64];
+   struct timespec start, end;
+   double dSeconds;
+   int iThreads, i;
+
+   if (iMaxThreads > 64)
+      iMaxThreads = 64;
+   HeapMgr_setArenaCount((unsigned int)iMaxThreads);
+   iThreadOps = iOps;
+
+   for (iThreads = 1; iThreads <= iMaxThreads; iThreads *= 2) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (i = 0; i < iThreads; i++)
+         pthread_create(&aThreads[i], NULL, throughputWorker, (void *)(size_t)(i + 1));
+      for (i = 0; i < iThreads; i++)
+         pthread_join(aThreads[i], NULL);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      dSeconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+      printf("%2d threads : %.0f ops/sec\n", iThreads, (double)iThreads * iOps / dSeconds);
+   }
+}
+
+/*--------------------------------------------------------------------*/
+
+/* Number of reallocations timed for each size of the realloc benchmark. */
+#define REALLOC_ROUNDS 200
+
+void benchRealloc()
+
+/* Time my_realloc() growing buffers of 64 bytes to 1 MB to twice their size.
+   A small chunk allocated after each buffer keeps most of them from growing
+   in place, so most calls copy; buffers above the mmap threshold are
+   remapped. Also check that binary data survives. */
+
+{
+   struct timespec start, end;
+   double dNanos, dTotal;
+   size_t uiSize, i;
+   char *p, *pcBlocker;
+   int iRound, iOk = TRUE;
+
+   for (uiSize = 64; uiSize <= ((size_t)1 << 20); uiSize *= 2) {
+      dTotal = 0;
+      for (iRound = 0; iRound < REALLOC_ROUNDS; iRound++) {
+         p = (char *)my_malloc(uiSize);
+         pcBlocker = (char *)my_malloc(1);
+         for (i = 0; i < uiSize; i++)
+            p[i] = (char)(i % 7);   /* Binary data with zero bytes */
+
+         clock_gettime(CLOCK_MONOTONIC, &start);
+         p = (char *)my_realloc(p, 2 * uiSize);
+         clock_gettime(CLOCK_MONOTONIC, &end);
+         dTotal += (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+         for (i = 0; i < uiSize; i++)
+            if (p[i] != (char)(i % 7))
+               iOk = FALSE;
+         my_free(pcBlocker);
+         my_free(p);
+      }
+      dNanos = dTotal / REALLOC_ROUNDS;
+      printf("%8lu bytes : %10.0f ns, %8.1f MB/s\n", (unsigned long)uiSize, dNanos, uiSize / dNanos * 1e3);
+   }
+   ASSURE(iOk);
+}
+
+/*--------------------------------------------------------------------*/
+
+#define BATCH_SIZE 32
+#define BATCH_ROUNDS 2000
+
+void benchBatch()
+
+/* Time allocating and freeing BATCH_SIZE regions of 32 bytes to 4 KB,
+   one at a time and with my_malloc_batch() and my_free_batch(). */
+
+{
+   struct timespec start, end;
+   double dOne, dBatch;
+   void *apvRegions[BATCH_SIZE];
+   size_t uiSize, i;
+   int iRound, iOk = TRUE;
+
+   for (uiSize = 32; uiSize <= 4096; uiSize *= 4) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (iRound = 0; iRound < BATCH_ROUNDS; iRound++) {
+         for (i = 0; i < BATCH_SIZE; i++)
+            apvRegions[i] = my_malloc(uiSize);
+         for (i = 0; i < BATCH_SIZE; i++)
+            my_free(apvRegions[i]);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      dOne = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      for (iRound = 0; iRound < BATCH_ROUNDS; iRound++) {
+         if (my_malloc_batch(uiSize, BATCH_SIZE, apvRegions) != BATCH_SIZE)
+            iOk = FALSE;
+         my_free_batch(apvRegions, BATCH_SIZE);
+      }
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      dBatch = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+
+      printf("%6lu bytes : %8.1f ns one by one, %8.1f ns batched per region\n", (unsigned long)uiSize,
+         dOne / (BATCH_ROUNDS * BATCH_SIZE), dBatch / (BATCH_ROUNDS * BATCH_SIZE));
+   }
+   ASSURE(iOk);
+   ASSURE(HeapMgr_isValid());
+}
+
+/*--------------------------------------------------------------------*/
+
 int main(int argc, char *argv[])
 
 /* Test the HeapMgr_malloc() and HeapMgr_free() functions.
@@ -189,6 +343,10 @@ int main(int argc, char *argv[])
    printf("2) Test for my_calloc()\n");
    printf("3) Test for my_realloc()\n");
    printf("4) Random test case\n");
+   printf("5) Multithreaded throughput test\n");
+   printf("6) Realloc benchmark\n");
+   printf("7) Batch allocation benchmark\n");
+   printf("8) Random test case, then dump the heap statistics as JSON\n");
    scanf("%d", &option);
 
    switch (option) {
@@ -212,6 +370,31 @@ int main(int argc, char *argv[])
          testRandomRandom(n, size);
          break;
 
+      case 5 :
+         printf("Enter the maximum number of threads : \n");
+         scanf("%d", &n);
+         printf("Enter the number of calls per thread : \n");
+         scanf("%d", &size);
+         testThroughput(n, size);
+         break;
+
+      case 6 :
+         benchRealloc();
+         break;
+
+      case 7 :
+         benchBatch();
+         break;
+
+      case 8 :
+         printf("Enter the number of chunks : \n");
+         scanf("%d", &n);
+         printf("Enter the max size boundary : \n");
+         scanf("%d", &size);
+         testRandomRandom(n, size);
+         my_heap_dump(stdout);
+         break;
+
       default : 
          break;
 
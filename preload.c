@@ -0,0 +1,204 @@
+/*****************************************************************************
+*    This file is part of project.
+*
+*    project is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    project is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with project.  If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/* The C library's allocation functions on top of the heap manager, built into
+   libheapmngr.so so that any program can run on it :
+
+      LD_PRELOAD=./libheapmngr.so <program>
+
+   The library is built with hidden visibility, so that only these functions
+   are exported. They add to the my_* functions what the C library promises
+   and the heap manager does not : a zero size gets a region of its own,
+   failures set errno, and memalign takes any alignment. */
+
+#include "heapmngr.h"
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#define EXPORT __attribute__((visibility("default")))
+
+/*--------------------------------------------------------------------*/
+
+static void *checkAlloc(void *pvRegion)
+
+/* Return pvRegion, setting errno to ENOMEM if it is NULL. */
+
+{
+   if (pvRegion == NULL)
+      errno = ENOMEM;
+   return pvRegion;
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *malloc(size_t uiSize)
+
+/* Allocate uiSize bytes. A zero size gets the smallest region. */
+
+{
+   return checkAlloc(my_malloc(uiSize == 0 ? 1 : uiSize));
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void free(void *pvRegion)
+
+/* Free pvRegion, if it is not NULL. */
+
+{
+   my_free(pvRegion);
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *calloc(size_t uiCount, size_t uiSize)
+
+/* Allocate uiCount zero filled elements of uiSize bytes.
+   my_calloc checks the product for overflow. */
+
+{
+   if (uiCount == 0 || uiSize == 0)
+      uiCount = uiSize = 1;
+   return checkAlloc(my_calloc(uiCount, uiSize));
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *realloc(void *pvRegion, size_t uiSize)
+
+/* Resize pvRegion to uiSize bytes. Like the C library, a zero size
+   frees pvRegion and returns NULL, and a NULL pvRegion allocates. */
+
+{
+   if (pvRegion == NULL)
+      return malloc(uiSize);
+   if (uiSize == 0) {
+      my_free(pvRegion);
+      return NULL;
+   }
+   return checkAlloc(my_realloc(pvRegion, uiSize));
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *reallocarray(void *pvRegion, size_t uiCount, size_t uiSize)
+
+/* Resize pvRegion to uiCount elements of uiSize bytes, failing with
+   ENOMEM if the product overflows. */
+
+{
+   if (uiSize != 0 && uiCount > SIZE_MAX / uiSize) {
+      errno = ENOMEM;
+      return NULL;
+   }
+   return realloc(pvRegion, uiCount * uiSize);
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT int posix_memalign(void **ppvRegion, size_t uiAlignment, size_t uiSize)
+
+/* Store in *ppvRegion a region of uiSize bytes aligned on uiAlignment.
+   Returns 0, EINVAL or ENOMEM, and leaves errno alone. */
+
+{
+   return my_posix_memalign(ppvRegion, uiAlignment, uiSize == 0 ? 1 : uiSize);
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *aligned_alloc(size_t uiAlignment, size_t uiSize)
+
+/* Allocate uiSize bytes aligned on uiAlignment, which must be a power
+   of two. */
+
+{
+   if (uiAlignment == 0 || (uiAlignment & (uiAlignment - 1)) != 0) {
+      errno = EINVAL;
+      return NULL;
+   }
+   return checkAlloc(my_aligned_alloc(uiAlignment, uiSize == 0 ? 1 : uiSize));
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *memalign(size_t uiAlignment, size_t uiSize)
+
+/* Allocate uiSize bytes aligned on uiAlignment, rounded up to a power
+   of two like the C library does. */
+
+{
+   size_t uiPower = 1;
+
+   while (uiPower < uiAlignment && uiPower <= SIZE_MAX / 4)
+      uiPower <<= 1;
+   if (uiPower < uiAlignment) {
+      errno = EINVAL;
+      return NULL;
+   }
+   return checkAlloc(my_memalign(uiPower, uiSize == 0 ? 1 : uiSize));
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *valloc(size_t uiSize)
+
+/* Allocate uiSize bytes aligned on a page. */
+
+{
+   return memalign((size_t)sysconf(_SC_PAGESIZE), uiSize);
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT void *pvalloc(size_t uiSize)
+
+/* Allocate uiSize bytes rounded up to whole pages, aligned on a page. */
+
+{
+   size_t uiPageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+   if (uiSize > SIZE_MAX - uiPageSize) {
+      errno = ENOMEM;
+      return NULL;
+   }
+   return memalign(uiPageSize, (uiSize + uiPageSize - 1) & ~(uiPageSize - 1));
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT size_t malloc_usable_size(void *pvRegion)
+
+/* Return the number of bytes usable in pvRegion, or 0 if it is NULL. */
+
+{
+   return my_malloc_usable_size(pvRegion);
+}
+
+/*--------------------------------------------------------------------*/
+
+EXPORT int malloc_trim(size_t uiPad)
+
+/* Give free memory back to the operating system. uiPad is ignored : the
+   heap manager keeps HeapMgr_setTrimThreshold() bytes on its own.
+   Returns 1 if any memory was released, or 0 otherwise. */
+
+{
+   (void)uiPad;
+   return my_heap_trim() != 0;
+}
@@ -0,0 +1,400 @@
+/*****************************************************************************
+*    This file is part of project.
+*
+*    project is free software: you can redistribute it and/or modify
+*    it under the terms of the GNU General Public License as published by
+*    the Free Software Foundation, either version 3 of the License, or
+*    (at your option) any later version.
+*
+*    project is distributed in the hope that it will be useful,
+*    but WITHOUT ANY WARRANTY; without even the implied warranty of
+*    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+*    GNU General Public License for more details.
+*
+*    You should have received a copy of the GNU General Public License
+*    along with project.  If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/* Replays a trace recorded with HeapMgr_startTrace() or HEAPMGR_TRACE against the heap
+   manager, in a single thread and in the order of the events' times, and reports the
+   throughput, the peak heap size and the fragmentation over time.
+
+   usage : replay <trace file> [number of samples] */
+
+#include "heapmngr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* How often the peak heap size is sampled, in events */
+#define PEAK_INTERVAL   1024
+
+/* Number of fragmentation samples printed by default */
+#define DEFAULT_SAMPLES 10
+
+/* An event of the trace, with its position in the file to keep the sort stable */
+typedef struct Event {
+   struct HeapMgrTraceRecord sRecord;
+   size_t uiIndex;
+} Event;
+
+/* An event ready to replay : the trace's addresses are resolved to object numbers */
+typedef struct Op {
+   enum HeapMgrTraceOp eOp;
+   size_t uiObject;
+   size_t uiSize;
+   size_t uiAlign;
+} Op;
+
+/* Hash table from the trace's addresses to object numbers, by linear probing */
+typedef struct IdTable {
+   uint64_t *pulIds;
+   size_t *puiObjects;
+   size_t uiMask;
+} IdTable;
+
+#define EMPTY_ID     0
+#define DELETED_ID   1
+
+/*--------------------------------------------------------------------*/
+
+static double now(void)
+
+/* Return the monotonic time in seconds. */
+
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*--------------------------------------------------------------------*/
+
+static Event *readTrace(const char *pcPath, size_t *puiCount, unsigned int *puiThreads)
+
+/* Read every event of the trace file pcPath, setting *puiCount to their number and
+   *puiThreads to the number of threads that recorded them. Return NULL if the file
+   cannot be read or is not a trace. */
+
+{
+   FILE *psFile;
+   char acMagic[8];
+   struct HeapMgrTraceBlock sBlock;
+   Event *psEvents = NULL, *psGrown;
+   size_t uiCount = 0, uiCapacity = 0, i;
+
+   *puiThreads = 0;
+
+   psFile = fopen(pcPath, "rb");
+   if (psFile == NULL)
+      return NULL;
+   if (fread(acMagic, 1, 8, psFile) != 8 || memcmp(acMagic, HEAPMGR_TRACE_MAGIC, 8) != 0) {
+      fprintf(stderr, "%s is not a heap manager trace\n", pcPath);
+      fclose(psFile);
+      return NULL;
+   }
+
+   while (fread(&sBlock, sizeof(sBlock), 1, psFile) == 1) {
+      if (sBlock.uiThread >= *puiThreads)
+         *puiThreads = sBlock.uiThread + 1;
+
+      while (uiCount + sBlock.uiCount > uiCapacity) {
+         uiCapacity = uiCapacity == 0 ? 4096 : 2 * uiCapacity;
+         psGrown = realloc(psEvents, uiCapacity * sizeof(Event));
+         if (psGrown == NULL) {
+            fprintf(stderr, "Out of memory reading %s\n", pcPath);
+            free(psEvents);
+            fclose(psFile);
+            return NULL;
+         }
+         psEvents = psGrown;
+      }
+
+      /* A block cut short by a crash still has its first records */
+      for (i = 0; i < sBlock.uiCount; i++) {
+         if (fread(&psEvents[uiCount].sRecord, sizeof(struct HeapMgrTraceRecord), 1, psFile) != 1)
+            break;
+         psEvents[uiCount].uiIndex = uiCount;
+         uiCount++;
+      }
+   }
+
+   fclose(psFile);
+   *puiCount = uiCount;
+   return psEvents;
+}
+
+/*--------------------------------------------------------------------*/
+
+static int compareEvents(const void *pvA, const void *pvB)
+
+/* qsort comparison of two events by time, then by position in the file. */
+
+{
+   const Event *psA = pvA, *psB = pvB;
+   uint64_t ulA = psA->sRecord.ulOpTime & HEAPMGR_TRACE_TIME_MASK;
+   uint64_t ulB = psB->sRecord.ulOpTime & HEAPMGR_TRACE_TIME_MASK;
+
+   if (ulA != ulB)
+      return ulA < ulB ? -1 : 1;
+   return (psA->uiIndex > psB->uiIndex) - (psA->uiIndex < psB->uiIndex);
+}
+
+/*--------------------------------------------------------------------*/
+
+static size_t *findId(IdTable *psTable, uint64_t ulId, int iInsert)
+
+/* Return the object number of the address ulId in the table, or NULL if it is not
+   there. If iInsert, add ulId first if it is not there. */
+
+{
+   size_t uiSlot = (size_t)((ulId * 0x9E3779B97F4A7C15u) >> 17) & psTable->uiMask;
+   size_t uiFree = (size_t)-1;
+
+   for (;; uiSlot = (uiSlot + 1) & psTable->uiMask) {
+      if (psTable->pulIds[uiSlot] == ulId)
+         return &psTable->puiObjects[uiSlot];
+      if (psTable->pulIds[uiSlot] == DELETED_ID && uiFree == (size_t)-1)
+         uiFree = uiSlot;
+      if (psTable->pulIds[uiSlot] == EMPTY_ID)
+         break;
+   }
+
+   if (! iInsert)
+      return NULL;
+   if (uiFree == (size_t)-1)
+      uiFree = uiSlot;
+   psTable->pulIds[uiFree] = ulId;
+   return &psTable->puiObjects[uiFree];
+}
+
+/*--------------------------------------------------------------------*/
+
+static Op *resolveEvents(Event *psEvents, size_t uiCount, size_t *puiOps, size_t *puiObjects,
+                         size_t *puiUnmatched, size_t *puiReused)
+
+/* Turn the sorted events into ops on object numbers, so that replaying them needs no
+   lookup. A free or realloc of an address that is not live is counted in *puiUnmatched
+   and dropped, or replayed as an allocation. An allocation at an address still live,
+   which events of different threads recorded at the same time may cause, is counted
+   in *puiReused and frees the old object first. Return NULL if out of memory. */
+
+{
+   IdTable sTable;
+   Op *psOps;
+   size_t uiCapacity = 2, i, uiOps = 0, uiObjects = 0;
+   size_t *puiObject;
+   struct HeapMgrTraceRecord *psRecord;
+   enum HeapMgrTraceOp eOp;
+
+   while (uiCapacity < 2 * uiCount)
+      uiCapacity *= 2;
+   sTable.pulIds = calloc(uiCapacity, sizeof(uint64_t));
+   sTable.puiObjects = malloc(uiCapacity * sizeof(size_t));
+   sTable.uiMask = uiCapacity - 1;
+   psOps = malloc(2 * uiCount * sizeof(Op) + 1);
+   if (sTable.pulIds == NULL || sTable.puiObjects == NULL || psOps == NULL) {
+      free(sTable.pulIds);
+      free(sTable.puiObjects);
+      free(psOps);
+      return NULL;
+   }
+
+   *puiUnmatched = 0;
+   *puiReused = 0;
+   for (i = 0; i < uiCount; i++) {
+      psRecord = &psEvents[i].sRecord;
+      eOp = (enum HeapMgrTraceOp)(psRecord->ulOpTime >> HEAPMGR_TRACE_OP_SHIFT);
+
+      if (eOp == HEAPMGR_TRACE_FREE || eOp == HEAPMGR_TRACE_REALLOC) {
+         puiObject = findId(&sTable, eOp == HEAPMGR_TRACE_FREE ? psRecord->ulId : psRecord->ulAux, 0);
+         if (puiObject == NULL) {
+            (*puiUnmatched)++;
+            if (eOp == HEAPMGR_TRACE_FREE)
+               continue;
+            eOp = HEAPMGR_TRACE_MALLOC;
+         }
+         else {
+            psOps[uiOps].eOp = eOp;
+            psOps[uiOps].uiObject = *puiObject;
+            psOps[uiOps].uiSize = (size_t)psRecord->ulSize;
+            psOps[uiOps].uiAlign = 0;
+            uiOps++;
+            sTable.pulIds[puiObject - sTable.puiObjects] = DELETED_ID;
+            if (eOp == HEAPMGR_TRACE_FREE)
+               continue;
+
+            /* The resized object lives on at its new address */
+            *findId(&sTable, psRecord->ulId, 1) = psOps[uiOps - 1].uiObject;
+            continue;
+         }
+      }
+
+      /* An allocation at an address still live frees the object there first */
+      puiObject = findId(&sTable, psRecord->ulId, 0);
+      if (puiObject != NULL) {
+         (*puiReused)++;
+         psOps[uiOps].eOp = HEAPMGR_TRACE_FREE;
+         psOps[uiOps].uiObject = *puiObject;
+         uiOps++;
+      }
+      else
+         puiObject = findId(&sTable, psRecord->ulId, 1);
+
+      psOps[uiOps].eOp = eOp;
+      psOps[uiOps].uiObject = uiObjects;
+      psOps[uiOps].uiSize = (size_t)psRecord->ulSize;
+      psOps[uiOps].uiAlign = (size_t)psRecord->ulAux;
+      uiOps++;
+      *puiObject = uiObjects++;
+   }
+
+   free(sTable.pulIds);
+   free(sTable.puiObjects);
+   *puiOps = uiOps;
+   *puiObjects = uiObjects;
+   return psOps;
+}
+
+/*--------------------------------------------------------------------*/
+
+static void replayOp(const Op *psOp, void **ppvObjects)
+
+/* Replay the op on its object in ppvObjects. */
+
+{
+   switch (psOp->eOp) {
+      case HEAPMGR_TRACE_MALLOC :
+         ppvObjects[psOp->uiObject] = my_malloc(psOp->uiSize);
+         break;
+
+      case HEAPMGR_TRACE_CALLOC :
+         ppvObjects[psOp->uiObject] = my_calloc(1, psOp->uiSize);
+         break;
+
+      case HEAPMGR_TRACE_MEMALIGN :
+         ppvObjects[psOp->uiObject] = my_memalign(psOp->uiAlign, psOp->uiSize);
+         break;
+
+      case HEAPMGR_TRACE_REALLOC :
+         ppvObjects[psOp->uiObject] = my_realloc(ppvObjects[psOp->uiObject], psOp->uiSize);
+         break;
+
+      case HEAPMGR_TRACE_FREE :
+         my_free(ppvObjects[psOp->uiObject]);
+         ppvObjects[psOp->uiObject] = NULL;
+         break;
+   }
+}
+
+/*--------------------------------------------------------------------*/
+
+static void printSample(size_t uiOps)
+
+/* Print a line of statistics and fragmentation after uiOps replayed ops. */
+
+{
+   struct HeapMgrStats sStats;
+   struct HeapMgrFragmentation sFrag;
+
+   my_heap_stats(&sStats);
+   my_heap_fragmentation(&sFrag);
+
+   printf("%12zu %10zu %10zu %10zu %10zu %10zu %9.4f %9.4f\n", uiOps,
+          sStats.uiHeapBytes >> 10, sStats.uiInUseBytes >> 10, sStats.uiFreeBytes >> 10,
+          sStats.uiSlabBytes >> 10, sStats.uiMappedBytes >> 10,
+          sFrag.uiFreeBytes == 0 ? 0.0 : 1.0 - (double)sFrag.uiLargestFree / sFrag.uiFreeBytes,
+          sFrag.uiGrantedBytes == 0 ? 0.0 : 1.0 - (double)sFrag.uiRequestedBytes / sFrag.uiGrantedBytes);
+}
+
+/*--------------------------------------------------------------------*/
+
+static size_t footprint(void)
+
+/* Return the bytes the heap manager holds : heaps, slabs and mappings. */
+
+{
+   struct HeapMgrStats sStats;
+
+   my_heap_stats(&sStats);
+   return sStats.uiHeapBytes + sStats.uiSlabBytes + sStats.uiMappedBytes;
+}
+
+/*--------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+
+/* Replay the trace named by argv[1], printing argv[2] samples along the way. */
+
+{
+   Event *psEvents;
+   Op *psOps;
+   void **ppvObjects;
+   size_t uiEvents, uiOps, uiObjects, uiUnmatched, uiReused, uiLive = 0;
+   size_t uiSamples = DEFAULT_SAMPLES, uiStep, uiNextSample, uiPeak = 0, uiBytes;
+   size_t i, j, uiEnd;
+   unsigned int uiThreads;
+   double dStart, dElapsed = 0;
+
+   if (argc < 2) {
+      fprintf(stderr, "usage : %s <trace file> [number of samples]\n", argv[0]);
+      return EXIT_FAILURE;
+   }
+   if (argc > 2 && atoi(argv[2]) > 0)
+      uiSamples = (size_t)atoi(argv[2]);
+
+   psEvents = readTrace(argv[1], &uiEvents, &uiThreads);
+   if (psEvents == NULL) {
+      perror(argv[1]);
+      return EXIT_FAILURE;
+   }
+   qsort(psEvents, uiEvents, sizeof(Event), compareEvents);
+
+   psOps = resolveEvents(psEvents, uiEvents, &uiOps, &uiObjects, &uiUnmatched, &uiReused);
+   ppvObjects = calloc(uiObjects + 1, sizeof(void *));
+   if (psOps == NULL || ppvObjects == NULL) {
+      fprintf(stderr, "Out of memory resolving %s\n", argv[1]);
+      return EXIT_FAILURE;
+   }
+
+   printf("Replaying %zu events of %u threads, spanning %.3f s\n", uiEvents, uiThreads,
+          uiEvents == 0 ? 0.0 : (psEvents[uiEvents - 1].sRecord.ulOpTime & HEAPMGR_TRACE_TIME_MASK) / 1e9);
+   printf("%12s %10s %10s %10s %10s %10s %9s %9s\n", "ops", "heap KB", "in use KB",
+          "free KB", "slab KB", "mapped KB", "ext frag", "int frag");
+   free(psEvents);
+
+   /* Only the ops are timed, not the sampling between every PEAK_INTERVAL of them */
+   uiStep = uiOps / uiSamples == 0 ? 1 : uiOps / uiSamples;
+   uiNextSample = uiStep;
+   for (i = 0; i < uiOps; i = uiEnd) {
+      uiEnd = uiOps - i > PEAK_INTERVAL ? i + PEAK_INTERVAL : uiOps;
+      dStart = now();
+      for (j = i; j < uiEnd; j++)
+         replayOp(&psOps[j], ppvObjects);
+      dElapsed += now() - dStart;
+
+      uiBytes = footprint();
+      if (uiBytes > uiPeak)
+         uiPeak = uiBytes;
+      if (uiEnd >= uiNextSample || uiEnd == uiOps) {
+         printSample(uiEnd);
+         while (uiNextSample <= uiEnd)
+            uiNextSample += uiStep;
+      }
+   }
+
+   for (i = 0; i < uiObjects; i++)
+      if (ppvObjects[i] != NULL)
+         uiLive++;
+
+   printf("Throughput : %zu ops in %.3f s, %.2f Mops/s\n", uiOps, dElapsed,
+          dElapsed > 0 ? uiOps / dElapsed / 1e6 : 0.0);
+   printf("Peak heap : %zu KB (heaps, slabs and mappings, sampled every %d ops)\n",
+          uiPeak >> 10, PEAK_INTERVAL);
+   printf("Objects left live : %zu, unmatched frees and reallocs : %zu, reused addresses : %zu\n",
+          uiLive, uiUnmatched, uiReused);
+
+   return EXIT_SUCCESS;
+}